@@ -17,8 +17,8 @@ class Dklab_Realplexor
     /**
      * Create new Realplexor API instance.
      *
-     * @param string $host        Host of IN line.
-     * @param integer $port       Port of IN line (if 443, SSL is used).
+     * @param string $host        Host of IN line ("unix:/path" for a Unix domain socket).
+     * @param integer $port       Port of IN line (if 443, SSL is used; ignored for Unix sockets).
      * @param string $namespace   Namespace to use.
      * @param string $identifier  Use this "identifier" marker instead of the default one.
      */
@@ -243,16 +243,21 @@ class Dklab_Realplexor
             . (isset($this->login) ? $this->login . ':' . $this->password . '@' : '')
             . $identifier
             . "\r\n";
+        $isUnix = str_starts_with($this->host, 'unix:');
         $data = 'POST / HTTP/1.1' . "\r\n"
-            . 'Host: ' . $this->host . "\r\n"
+            . 'Host: ' . ($isUnix ? 'localhost' : $this->host) . "\r\n"
             . 'Content-Length: ' . mb_strlen($body) . "\r\n"
             . $headers
             . "\r\n"
             . $body;
 
         // Proceed with sending.
-        $host = $this->port === 443 ? 'ssl://' . $this->host : $this->host;
-        $f = @fsockopen($host, $this->port, $errno, $errstr, $this->timeout);
+        if ($isUnix) {
+            $f = @stream_socket_client('unix://' . substr($this->host, 5), $errno, $errstr, $this->timeout);
+        } else {
+            $host = $this->port === 443 ? 'ssl://' . $this->host : $this->host;
+            $f = @fsockopen($host, $this->port, $errno, $errstr, $this->timeout);
+        }
         if (!$f) {
             throw new Dklab_Realplexor_Exception('Error #' . $errno . ': ' . $errstr);
         }
@@ -6,15 +6,16 @@ from typing import Union, Optional, List, Dict
 class Dklab_Realplexor:
     """Dklab_Realplexor python API v2.0."""
 
-    def __init__(self, host: str, port: int, namespace: str = '', identifier: str = 'identifier'):
+    def __init__(self, host: str, port: int, namespace: str = '', identifier: str = 'identifier', persistent: bool = False):
         """
         Create new Realplexor API instance.
 
         Keyword arguments:
-        host -- Host of IN line.
-        port -- Port of IN line (if 443, SSL is used).
+        host -- Host of IN line ("unix:/path" for a Unix domain socket).
+        port -- Port of IN line (if 443, SSL is used; ignored for Unix sockets).
         namespace -- Namespace to use.
         identifier -- Use this "identifier" marker instead of the default one.
+        persistent -- Keep the connection to IN line open between requests.
         """
         self._login: Optional[str] = None
         self._password: Optional[str] = None
@@ -23,6 +24,8 @@ class Dklab_Realplexor:
         self._port: int = port
         self._namespace: str = namespace
         self._identifier: str = identifier
+        self._persistent: bool = persistent
+        self._sock: Optional[socket.socket] = None
 
     def logon(self, login: str, password: str) -> None:
         """
@@ -53,6 +56,63 @@ class Dklab_Realplexor:
                                      client IDs in $showOnlyForIds to not send messages to others.
         """
         payload = json.dumps(data)
+        resp = self._send(self._build_pairs(ids_and_cursors, show_only_for_ids), payload)
+        if not resp.strip():
+            return {}
+
+        # Parse the result and trim namespace.
+        result = {}
+        for line in resp.strip().splitlines():
+            try:
+                id_, cursor = line.strip().split()
+                if self._namespace and id_.startswith(self._namespace):
+                    id_ = id_.removeprefix(self._namespace)
+                result[id_] = int(cursor)
+            except ValueError:
+                continue
+
+        return result
+
+    def send_batch(
+            self,
+            messages: List[tuple]
+    ) -> List[Dict[str, int]]:
+        """
+        Send multiple data messages to realplexor within one request.
+        Throw Dklab_Realplexor_Exception in case of error.
+
+        messages -- List of (ids_and_cursors, data) or (ids_and_cursors, data, show_only_for_ids)
+                    tuples, see send() for details.
+        Returns list of dictionaries (id => cursor), one per message.
+        """
+        body = "BATCH\n"
+        for message in messages:
+            ids_and_cursors, data = message[0], message[1]
+            show_only_for_ids = message[2] if len(message) > 2 else None
+            payload = json.dumps(data)
+            pairs = self._build_pairs(ids_and_cursors, show_only_for_ids)
+            body += f"{pairs} {len(payload.encode())}\n{payload}\n"
+
+        resp = self._send(None, body)
+
+        # Parse the result ("cursor:id,cursor:id" line per message) and trim namespace.
+        results = []
+        for line in resp.splitlines():
+            result = {}
+            for item in filter(None, line.strip().split(",")):
+                cursor, id_ = item.split(":", 1)
+                if self._namespace and id_.startswith(self._namespace):
+                    id_ = id_.removeprefix(self._namespace)
+                result[id_] = int(cursor)
+            results.append(result)
+        return results
+
+    def _build_pairs(
+            self,
+            ids_and_cursors: Union[List[str], Dict[str, Union[int, None]]],
+            show_only_for_ids: Optional[List[str]] = None
+    ) -> str:
+        """Build identifier list (with namespace) for the IN line."""
         pairs = []
 
         if isinstance(ids_and_cursors, list):
@@ -77,22 +137,7 @@ class Dklab_Realplexor:
         if show_only_for_ids:
             pairs += [f"*{self._namespace or ''}{id_}" for id_ in show_only_for_ids]
 
-        resp = self._send(",".join(pairs), payload)
-        if not resp.strip():
-            return {}
-
-        # Parse the result and trim namespace.
-        result = {}
-        for line in resp.strip().splitlines():
-            try:
-                id_, cursor = line.strip().split()
-                if self._namespace and id_.startswith(self._namespace):
-                    id_ = id_.removeprefix(self._namespace)
-                result[id_] = int(cursor)
-            except ValueError:
-                continue
-
-        return result
+        return ",".join(pairs)
 
     def cmdOnlineWithCounters(self, id_prefixes: Optional[List[str]] = None) -> Dict[str, str]:
         """
@@ -169,6 +214,12 @@ class Dklab_Realplexor:
                 events.append({"event": event, "pos": int(pos), "id": id_})
         return events
 
+    def close(self) -> None:
+        """Close the persistent connection (if any)."""
+        if self._sock:
+            self._sock.close()
+            self._sock = None
+
     def _sendCmd(self, cmd: str) -> str:
         return self._send(None, f"{cmd}\n")
 
@@ -190,25 +241,26 @@ class Dklab_Realplexor:
             headers += f"{self._login}:{self._password}@"
         headers += f"{identifier or ''}\r\n"
 
+        is_unix = self._host.startswith("unix:")
         request = (
             f"POST / HTTP/1.1\r\n"
-            f"Host: {self._host}\r\n"
-            f"Content-Length: {len(body)}\r\n"
-            f"{headers}\r\n"
+            f"Host: {'localhost' if is_unix else self._host}\r\n"
+            f"Content-Length: {len(body.encode())}\r\n"
+            + ("Connection: keep-alive\r\n" if self._persistent else "")
+            + f"{headers}\r\n"
             f"{body}"
         )
 
         # Proceed with sending.
-        result = b''
-        host = self._host
-        if self._port == 443:
-            host = f"ssl://{self._host}"
-
-        with socket.create_connection((self._host, self._port), timeout=self._timeout) as s:
-            s.sendall(request.encode())
-            s.shutdown(socket.SHUT_WR)
-            while chunk := s.recv(4096):
-                result += chunk
+        if self._persistent:
+            result = self._roundtrip_persistent(request.encode())
+        else:
+            with self._connect() as s:
+                s.sendall(request.encode())
+                s.shutdown(socket.SHUT_WR)
+                result = b''
+                while chunk := s.recv(4096):
+                    result += chunk
 
         result_str = result.decode()
         # Analyze the result.
@@ -238,6 +290,68 @@ class Dklab_Realplexor:
         return ""
 
 
+    def _connect(self) -> socket.socket:
+        """Open a new connection to IN line."""
+        if self._host.startswith("unix:"):
+            s = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+            s.settimeout(self._timeout)
+            try:
+                s.connect(self._host[len("unix:"):])
+            except OSError:
+                s.close()
+                raise
+            return s
+        # "[::1]" form is accepted for IPv6 hosts.
+        return socket.create_connection((self._host.strip("[]"), self._port), timeout=self._timeout)
+
+    def _roundtrip_persistent(self, request: bytes) -> bytes:
+        """
+        Send the request via the persistent connection and read exactly
+        one response (framed by Content-Length). If the server has closed
+        a reused connection (e.g. by IN_TIMEOUT), i.e. sending fails or
+        the connection is closed before any response byte, the request
+        is sent once again via a new connection. Other errors (timeouts
+        included) are raised: the request may be already processed.
+        """
+        for attempt in range(2):
+            reused = self._sock is not None and not attempt
+            if not self._sock:
+                self._sock = self._connect()
+            try:
+                try:
+                    self._sock.sendall(request)
+                except OSError as e:
+                    if not reused or isinstance(e, socket.timeout):
+                        raise
+                    self.close()
+                    continue
+                chunk = self._sock.recv(4096)
+                if not chunk and reused:
+                    self.close()
+                    continue
+                result = chunk
+                while b"\r\n\r\n" not in result:
+                    if not chunk:
+                        raise ConnectionError("connection closed")
+                    chunk = self._sock.recv(4096)
+                    result += chunk
+                head, body = result.split(b"\r\n\r\n", 1)
+                m = re.search(rb'Content-Length:\s*(\d+)', head, re.IGNORECASE)
+                need_len = int(m.group(1)) if m else 0
+                while len(body) < need_len:
+                    chunk = self._sock.recv(max(4096, need_len - len(body)))
+                    if not chunk:
+                        raise ConnectionError("connection closed")
+                    body += chunk
+                if not re.search(rb'^Connection:\s*keep-alive', head, re.IGNORECASE | re.MULTILINE):
+                    self.close()
+                return head + b"\r\n\r\n" + body
+            except OSError:
+                self.close()
+                raise
+        return b''
+
+
 class Dklab_Realplexor_Exception(Exception):
     """Realplexor-dedicated exception class."""
     pass
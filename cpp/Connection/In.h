@@ -30,19 +30,243 @@ using namespace Realplexor;
 using std::shared_ptr;
 using std::exception;
 
+// Fully parsed and authenticated IN request. It is built by the IN
+// connection (possibly within the IN thread) and processed within
+// the main loop, because only it may touch Storages and send data.
+// Its payload handles are not thread-safe, so the connection must not
+// keep references to them after the request is built.
+struct InRequest
+{
+    fh_t fh;
+    Realplexor::Event::ServerBase* server;
+    string login;
+    string cmd; // empty if data is published
+    string arg;
+    DataPairChain pairs;
+    LimitIdsRef limit_ids;
+    DataRef refdata;
+    DataRecordChain records; // for BATCH command
+    string response; // non-empty if the request is rejected
+    string code;
+    bool keep_alive; // if true, the connection is not closed after the response
+    bool binary; // if true, the response is framed by binary protocol (see InBinary)
+
+    InRequest(const fh_t& fh, Realplexor::Event::ServerBase* server, const string& login, bool keep_alive = false):
+        fh(fh), server(server), login(login), keep_alive(keep_alive), binary(false) {}
+
+    // Called within the main loop.
+    void process()
+    {
+        if (response.length()) {
+            _send_response(response, code);
+        } else if (cmd == "ONLINE") {
+            _cmd_online(arg);
+        } else if (cmd == "STATS") {
+            _cmd_stats(arg);
+        } else if (cmd == "WATCH") {
+            _cmd_watch(arg);
+        } else if (cmd == "BATCH") {
+            _cmd_batch();
+        } else if (cmd == "LOGIN") {
+            _send_response("");
+        } else {
+            _cmd_publish();
+        }
+    }
+
+    // Convert space-delimited ID prefixes list to prefix checker.
+    shared_ptr<prefix_checker> _id_prefixes_to_checker(const string& id_prefixes)
+    {
+        vector<string> list;
+        if (id_prefixes.length()) list = split(regex("\\s+"), id_prefixes);
+        return shared_ptr<prefix_checker>(new prefix_checker(list, login.length()? login + "_" : ""));
+    }
+
+    // Prints a debug message.
+    void debug_(const string& msg)
+    {
+        server->debug_(fh, msg);
+    }
+
+private:
+
+    // Publish data to already filtered pairs.
+    void _cmd_publish()
+    {
+        std::vector<ident_t> ids_to_process;
+        std::vector<std::string> lines;
+        for (auto& pair: pairs) {
+            // Add data to queue and set lifetime.
+            ids_to_process.push_back(pair.id);
+            Realplexor::Common::push_data_to_id(pair.id, pair.cursor, refdata, limit_ids);
+
+            // collect id + cursor for the output
+            lines.push_back(pair.id.str() + " " + lexical_cast<std::string>(pair.cursor) + "\n");
+        }
+        // One debug message per connection.
+        if (ids_to_process.size()) {
+            DEBUG("added data for [" + join(interned_strs(ids_to_process), ",") + "]");
+        }
+        // Pass the data to other WAIT workers and send pending data
+        // (together with other publishes of this loop iteration).
+        workers.broadcast_data(pairs, limit_ids, refdata);
+        Realplexor::Common::send_pendings_later(ids_to_process);
+
+        // return passed or newly created cursor(s) of the event
+        _send_response(join(lines, ""));
+    }
+
+    // Command: publish multiple data records. All records are queued
+    // first, then pending data is sent to the union of their IDs at once.
+    // Response contains a line of "cursor:id" pairs per record.
+    void _cmd_batch()
+    {
+        std::vector<ident_t> ids_to_process;
+        std::unordered_set<ident_t> seen_ids;
+        std::vector<std::string> lines;
+        for (auto& record: records) {
+            std::vector<std::string> cursors;
+            for (auto& pair: record.pairs) {
+                Realplexor::Common::push_data_to_id(pair.id, pair.cursor, record.rdata, record.limit_ids);
+                if (seen_ids.insert(pair.id).second) ids_to_process.push_back(pair.id);
+                cursors.push_back(lexical_cast<std::string>(pair.cursor) + ":" + pair.id.str());
+            }
+            workers.broadcast_data(record.pairs, record.limit_ids, record.rdata);
+            lines.push_back(join(cursors, ",") + "\n");
+        }
+        if (ids_to_process.size()) {
+            DEBUG("added batch data for [" + join(interned_strs(ids_to_process), ",") + "]");
+        }
+        Realplexor::Common::send_pendings_later(ids_to_process);
+        _send_response(join(lines, ""));
+    }
+
+    // Command: fetch all online IDs.
+    void _cmd_online(const std::string& id_prefixes)
+    {
+        std::vector<ident_t> ids;
+        online_timers.get_ids_ref(_id_prefixes_to_checker(id_prefixes), ids);
+        DEBUG("sending " + lexical_cast<std::string>(ids.size()) + " online identifiers");
+
+        auto lines = map_to_vector(ids, [](const ident_t& id) {
+            return id.str() + " " + lexical_cast<std::string>(workers.get_num_fhs_by_id(id)) + "\n";
+        });
+
+        _send_response(join(lines, ""));
+    }
+
+    // Command: watch for clients online/offline status changes.
+    void _cmd_watch(const std::string& arg)
+    {
+        smatch m;
+        cursor_t cursor = 0;
+        std::string id_prefixes = "";
+        try {
+            if (regex_search(arg, m, regex("^(\\S+)\\s+(.*)$"))) {
+                cursor = lexical_cast<cursor_t>(m[1]);
+                id_prefixes = m[2];
+            } else {
+                cursor = lexical_cast<cursor_t>(arg);
+            }
+        } catch (const bad_lexical_cast&) {
+            cursor = 0;
+        }
+        DataEventChain list;
+        events.get_recent_events(cursor, _id_prefixes_to_checker(id_prefixes), list);
+        DEBUG("sending " + lexical_cast<std::string>(list.size()) + " events");
+
+        auto lines = map_to_vector(list, [](const DataEvent& e) {
+            return e.getType() + " " + lexical_cast<std::string>(e.cursor) + ":" + e.id.str() + "\n";
+        });
+
+        _send_response(join(lines, ""));
+    }
+
+    // Command: dump debug statistics ("STATS arena" dumps allocator
+    // statistics of message data instead).
+    // This command is for internal debugging only.
+    void _cmd_stats(const string& arg)
+    {
+        if (login.length()) {
+            // Keep-alive client waits for a response anyway.
+            if (keep_alive) _send_response("");
+            return;
+        }
+        if (arg == "arena") {
+            DEBUG("sending arena stats");
+            _send_response("[payload_arena]\n" + payload_arena::get_stats());
+            return;
+        }
+        if (arg == "loop") {
+            DEBUG("sending loop stats");
+            _send_response(
+                "[loop]\n"
+                "max_pause: " + lexical_cast<string>(loop_lag.take_max_pause()) + "\n"
+                "deferred_fhs: " + lexical_cast<string>(Realplexor::Common::get_num_deferred()) + "\n"
+            );
+            return;
+        }
+        DEBUG("sending stats");
+        _send_response(
+            "[data_to_send]\n" +
+            data_to_send.get_stats() +
+            "\n[connected_fhs]\n" +
+            connected_fhs.get_stats() +
+            "\n[online_timers]\n" +
+            online_timers.get_stats() +
+            "\n[cleanup_timers]\n" +
+            cleanup_timers.get_stats() +
+            "\n[pairs_by_fhs]\n" +
+            pairs_by_fhs.get_stats()
+        );
+    }
+
+    // Send response anc close the connection (unless it is keep-alive).
+    void _send_response(const string& d, const string& code = "")
+    {
+        if (binary) {
+            // [u32 length][u8 status][text]; non-zero status means an error.
+            uint32_t len = htonl(d.length());
+            fh->send(string((const char*)&len, 4) + (code.length()? '\1' : '\0') + d);
+            if (!keep_alive) fh->shutdown(2);
+            return;
+        }
+        fh->send(
+            (keep_alive? "HTTP/1.1 " : "HTTP/1.0 ") + (code.length()? code : "200 OK") + "\r\n" +
+            (keep_alive? "Connection: keep-alive\r\n" : "") +
+            "Content-Type: text/plain\r\n" +
+            "Content-Length: " + lexical_cast<string>(d.length()) + "\r\n\r\n" +
+            d
+        );
+        if (!keep_alive) fh->shutdown(2);
+    }
+};
+
+
 class In: public Realplexor::Event::Connection
 {
     shared_ptr<DataPairChain> pairs;
-    shared_ptr<LimitIdsSet> limit_ids;
+    LimitIdsRef limit_ids;
     CredPair cred;
+    RequestParser parser;
+
+    // True while a keep-alive request is processed; _dispatched is
+    // set when a request is passed to the main loop.
+    bool _keep_alive;
+    bool _dispatched;
 
 public:
 
+    // If set, requests are passed to the main loop via this queue
+    // (IN line is served by a separate thread), else they are
+    // processed immediately.
+    static Realplexor::Event::Queue<InRequest>* queue;
+
     // Called on a new connection.
-    In(fh_t fh, Realplexor::Event::ServerBase* server): Connection(fh, server)
+    In(fh_t fh, Realplexor::Event::ServerBase* server): Connection(fh, server), _keep_alive(false), _dispatched(false)
     {
         pairs.reset(new DataPairChain());
-        limit_ids.reset(new LimitIdsSet());
+        limit_ids = make_local<RefLimitIdsSet>();
     }
 
     // Hack: unfortunately C++ cannot call overriden virtual functions from base class destructors.
@@ -51,12 +275,34 @@ public:
         ondestruct();
     }
 
+    // Passes the request to the main loop (or processes it immediately
+    // if IN line is served by the main thread).
+    static void submit(InRequest* req)
+    {
+        if (queue) {
+            queue->push(req);
+        } else {
+            process(req);
+        }
+    }
+
+    // Processes the request within the main loop.
+    static void process(InRequest* req)
+    {
+        try {
+            req->process();
+        } catch (exception& e) {
+            req->server->error(req->fh, e.what());
+        }
+        delete req;
+    }
+
     // Called on timeout.
     void ontimeout()
     {
         Realplexor::Event::Connection::ontimeout();
         pairs->clear();
-        rdata = "";
+        _clear_rdata();
     }
 
     // Called on error.
@@ -64,7 +310,7 @@ public:
     {
         Realplexor::Event::Connection::onerror(msg);
         pairs->clear();
-        rdata = "";
+        _clear_rdata();
     }
 
     // Called when a data is available to read.
@@ -72,23 +318,36 @@ public:
     {
         Realplexor::Event::Connection::onread(nread);
 
-        // Try to extract ID from the new data chunk.
-        if (!pairs->size()) {
-            if (Realplexor::Common::extract_pairs(rdata, *pairs, *limit_ids, cred)) {
-                DEBUG(
-                    "parsed IDs"
-                    + (limit_ids->size()? "; limiters are (" + join(sort_keys(*limit_ids), ", ") + ")" : "")
-                    + (cred.login.length()? "; login is \"" + cred.login + "\"" : "")
-                );
-                _assert_auth();
-            }
+        // Process complete keep-alive requests one by one; responses
+        // are sent in the same order.
+        string message;
+        while (_cut_keep_alive_request(message)) {
+            string tail;
+            tail.swap(rdata);
+            rdata.swap(message);
+            _keep_alive = true;
+            _extract_pairs();
+            if (!_try_process_cmd(true)) _try_process_pairs();
+            // Each request must be answered to keep responses in order.
+            if (!_dispatched) _dispatch(new InRequest(fh(), server(), cred.login, true));
+            _keep_alive = false;
+            _dispatched = false;
+            pairs->clear();
+            limit_ids = make_local<RefLimitIdsSet>();
+            cred.login.clear();
+            cred.password.clear();
+            parser.reset();
+            rdata.swap(tail);
         }
 
+        // Try to extract ID from the new data chunk.
+        _extract_pairs();
+
         // Try to process cmd.
         if (_try_process_cmd(false)) return;
 
         // Check for the data overflow.
-        if (rdata.length() > CONFIG.in_maxlen) {
+        if (rdata.length() > CONFIG.locked(CONFIG.in_maxlen)) {
             die("overflow (received " + lexical_cast<string>(rdata.length()) + " bytes total)");
         }
     }
@@ -96,6 +355,14 @@ public:
     // Called on client side disconnect.
     virtual void onclose()
     {
+        // A request with Content-Length is incomplete if the client is
+        // disconnected before its whole body is received.
+        if (parser.truncated(rdata)) {
+            DEBUG("request body is truncated, ignored");
+            pairs->clear();
+            _clear_rdata();
+            return;
+        }
         // First, try to process cmd.
         if (_try_process_cmd(true)) return;
         // Then, try to send messages.
@@ -104,27 +371,66 @@ public:
 
 private:
 
+    // Passes the request to the main loop.
+    void _dispatch(InRequest* req)
+    {
+        _dispatched = true;
+        pairs->clear();
+        _clear_rdata();
+        submit(req);
+    }
+
+    // Forgets the received data (and its parsing state).
+    void _clear_rdata()
+    {
+        rdata = "";
+        parser.reset();
+    }
+
+    // Extracts IDs from the received data (if not extracted yet).
+    void _extract_pairs()
+    {
+        if (parser.identifier_found()) return;
+        bool extracted;
+        {
+            std::lock_guard<std::mutex> lock(CONFIG.mutex);
+            extracted = parser.extract_pairs(rdata, *pairs, *limit_ids, cred);
+        }
+        if (extracted) {
+            DEBUG(
+                "parsed IDs"
+                + (limit_ids->size()? "; limiters are (" + join(interned_strs(sort_keys(*limit_ids)), ", ") + ")" : "")
+                + (cred.login.length()? "; login is \"" + cred.login + "\"" : "")
+            );
+            _assert_auth();
+        }
+    }
+
+    // Cuts the first complete keep-alive request from the received data:
+    // its headers must contain "Connection: keep-alive" and Content-Length,
+    // and the whole body must be received. Other requests are processed
+    // when the client closes its side of the connection. The parser
+    // state remains valid for the cut request.
+    bool _cut_keep_alive_request(string& message)
+    {
+        size_t len = parser.keep_alive_length(rdata);
+        if (len == string::npos) return false;
+        message.assign(rdata, 0, len);
+        rdata.erase(0, len);
+        return true;
+    }
+
     // Assert that authentication is OK.
     void _assert_auth()
     {
         try {
-            if (cred.login.length()) {
-                // Login + password are passed. Check credentials.
-                if (!CONFIG.users.count(cred.login)) {
-                    die("unknown login: " + cred.login);
-                }
-                string pwd_hash = CONFIG.users.get(cred.login);
-                if (crypt(cred.password.c_str(), pwd_hash.c_str()) != pwd_hash) {
-                    die("invalid password for login: " + cred.login);
-                }
-            } else if (!CONFIG.users.count("")) {
-                // Guest access, but no guest account is found.
-                die("access denied for guest user");
-            }
+            Realplexor::Common::check_credentials(cred.login, cred.password);
         } catch (exception& e) {
-            pairs->clear();
-            rdata = "";
-            _send_response(string(e.what()) + "\n", "403 Access Deined");
+            // The connection is closed after this response.
+            InRequest* req = new InRequest(fh(), server(), cred.login);
+            req->response = string(e.what()) + "\n";
+            req->code = "403 Access Deined";
+            _dispatch(req);
             throw;
         }
     }
@@ -135,163 +441,104 @@ private:
     bool _try_process_cmd(bool finished_reading)
     {
         if (!rdata.length()) return false;
-        // Try to extract cmd.
-        string tail_re = finished_reading? "\r?\n\r?\n|$" : "\r?\n\r?\n";
-        regex re_in_cmd("(?:^|\r?\n\r?\n)(ONLINE|STATS|WATCH)(?:\\s+([^\r\n]*))?(?:" + tail_re + ")", regex::icase);
-        boost::smatch m;
-        if (!regex_search(rdata, m, re_in_cmd)) return false;
-        string cmd = to_upper_copy(string(m[1]));
-        string arg = m[2];
+        string cmd, arg;
+        size_t pos;
+        if (!parser.command(rdata, finished_reading, cmd, arg, pos)) return false;
+        // Batch data may contain anything, so it is processed only
+        // when the whole request is received.
+        if (cmd == "BATCH") {
+            if (!finished_reading) return false;
+            _process_batch(pos);
+            return true;
+        }
         // Cmd extracted, process it.
         pairs->clear();
-        rdata = "";
+        _clear_rdata();
         // Assert authorization.
         _assert_auth();
         DEBUG("received aux command: " + cmd + (arg.length()? " " + arg : ""));
-        fh()->shutdown(0); // stop reading
-        if (cmd == "ONLINE") {
-            _cmd_online(arg);
-        } else if (cmd == "STATS") {
-            _cmd_stats(arg);
-        } else if (cmd == "WATCH") {
-            _cmd_watch(arg);
-        }
+        if (!_keep_alive) fh()->shutdown_read();
+        InRequest* req = new InRequest(fh(), server(), cred.login, _keep_alive);
+        req->cmd = cmd;
+        req->arg = arg;
+        _dispatch(req);
         return true;
     }
 
+    // Process batch publish request; its records start from pos.
+    void _process_batch(size_t pos)
+    {
+        DataRecordChain records;
+        string error;
+        try {
+            std::lock_guard<std::mutex> lock(CONFIG.mutex);
+            Realplexor::Common::extract_batch_records(rdata, pos, records);
+        } catch (exception& e) {
+            error = e.what();
+        }
+        pairs->clear();
+        _clear_rdata();
+        // Assert authorization.
+        _assert_auth();
+        DEBUG("received batch of " + lexical_cast<string>(records.size()) + " records" + (error.length()? ": " + error : ""));
+        if (!_keep_alive) fh()->shutdown_read();
+        InRequest* req = new InRequest(fh(), server(), cred.login, _keep_alive);
+        req->cmd = "BATCH";
+        if (error.length()) {
+            req->response = error + "\n";
+            req->code = "400 Bad Request";
+        } else {
+            auto checker = req->_id_prefixes_to_checker("");
+            for (auto& record: records) {
+                DataRecord owned;
+                owned.limit_ids.swap(record.limit_ids);
+                owned.rdata.swap(record.rdata);
+                for (auto& pair: record.pairs) {
+                    // Check if it is not own pair.
+                    if (!checker->matched(pair.id.str())) {
+                        DEBUG("skipping not owned [" + pair.id.str() + "] for login " + cred.login);
+                        continue;
+                    }
+                    owned.pairs.push_back(pair);
+                }
+                req->records.push_back(owned);
+            }
+        }
+        _dispatch(req);
+    }
+
     // Try to process pairs.
     bool _try_process_pairs()
     {
         if (!rdata.length()) return false;
         if (pairs->size()) {
             // Clear headers from the data.
-            size_t pos_body;
-            if (!get_http_body(rdata, pos_body)) {
+            size_t pos_body = parser.body(rdata);
+            if (pos_body == string::npos) {
                 DEBUG("passed empty HTTP body, ignored");
-                rdata = "";
+                _clear_rdata();
                 return false;
             }
-            std::vector<ident_t> ids_to_process;
-            std::vector<std::string> lines;
-            auto checker = _id_prefixes_to_checker("");
-            auto refdata = shared_ptr<string>(new string(rdata, pos_body));
+            InRequest* req = new InRequest(fh(), server(), cred.login, _keep_alive);
+            req->limit_ids.swap(limit_ids);
+            limit_ids = make_local<RefLimitIdsSet>();
+            req->refdata = make_local<RefString>(rdata, pos_body);
+            auto checker = req->_id_prefixes_to_checker("");
             for (auto& pair: *pairs) {
-                cursor_t cursor = pair.cursor;
-                ident_t id = pair.id;
                 // Check if it is not own pair.
-                if (!checker->matched(id)) {
-                    DEBUG("skipping not owned [" + id + "] for login " + cred.login);//
+                if (!checker->matched(pair.id.str())) {
+                    DEBUG("skipping not owned [" + pair.id.str() + "] for login " + cred.login);//
                     continue;
                 }
-                // Add data to queue and set lifetime.
-                ids_to_process.push_back(id);
-                data_to_send.add_dataref_to_id(id, cursor, refdata, limit_ids);
-                int timeout = CONFIG.clean_id_after;
-                auto callback = [id, timeout]() {
-                    data_to_send.clear_id(id);
-                    LOGGER("[" + id + "] cleaned, because no data is pushed within last " + lexical_cast<string>(timeout) + " seconds");
-                };
-                cleanup_timers.start_timer_for_id<decltype(callback)>(id, timeout, callback);
-
-                // collect id + cursor for the output
-                lines.push_back(pair.id + " " + lexical_cast<std::string>(pair.cursor) + "\n");
+                req->pairs.push_back(pair);
             }
-            // One debug message per connection.
-            if (ids_to_process.size()) {
-                DEBUG("added data for [" + join(ids_to_process, ",") + "]");
-            }
-            // Send pending data.
-            Realplexor::Common::send_pendings(ids_to_process);
-
-            // return passed or newly created cursor(s) of the event
-            _send_response(join(lines, ""));
+            _dispatch(req);
         }
         return false;
     }
-
-    // Convert space-delimited ID prefixes list to prefix checker.
-    shared_ptr<prefix_checker> _id_prefixes_to_checker(const string& id_prefixes)
-    {
-        vector<string> list;
-        if (id_prefixes.length()) list = split(regex("\\s+"), id_prefixes);
-        return shared_ptr<prefix_checker>(new prefix_checker(list, cred.login.length()? cred.login + "_" : ""));
-    }
-
-    // Command: fetch all online IDs.
-    void _cmd_online(const std::string& id_prefixes)
-    {
-        std::vector<ident_t> ids;
-        online_timers.get_ids_ref(_id_prefixes_to_checker(id_prefixes), ids);
-        DEBUG("sending " + lexical_cast<std::string>(ids.size()) + " online identifiers");
-
-        auto lines = map_to_vector(ids, [](const std::string& id) {
-            return id + " " + lexical_cast<std::string>(connected_fhs.get_num_fhs_by_id(id)) + "\n";
-        });
-
-        _send_response(join(lines, ""));
-    }
-
-    // Command: watch for clients online/offline status changes.
-    void _cmd_watch(const std::string& arg)
-    {
-        smatch m;
-        cursor_t cursor = 0;
-        std::string id_prefixes = "";
-        try {
-            if (regex_search(arg, m, regex("^(\\S+)\\s+(.*)$"))) {
-                cursor = lexical_cast<cursor_t>(m[1]);
-                id_prefixes = m[2];
-            } else {
-                cursor = lexical_cast<cursor_t>(arg);
-            }
-        } catch (const bad_lexical_cast&) {
-            cursor = 0;
-        }
-        DataEventChain list;
-        events.get_recent_events(cursor, _id_prefixes_to_checker(id_prefixes), list);
-        DEBUG("sending " + lexical_cast<std::string>(list.size()) + " events");
-
-        auto lines = map_to_vector(list, [](const DataEvent& e) {
-            return e.getType() + " " + lexical_cast<std::string>(e.cursor) + ":" + e.id + "\n";
-        });
-
-        _send_response(join(lines, ""));
-    }
-
-    // Command: dump debug statistics.
-    // This command is for internal debugging only.
-    void _cmd_stats(const string& arg)
-    {
-        if (cred.login.length()) return;
-        DEBUG("sending stats");
-        _send_response(
-            "[data_to_send]\n" +
-            data_to_send.get_stats() +
-            "\n[connected_fhs]\n" +
-            connected_fhs.get_stats() +
-            "\n[online_timers]\n" +
-            online_timers.get_stats() +
-            "\n[cleanup_timers]\n" +
-            cleanup_timers.get_stats() +
-            "\n[pairs_by_fhs]\n" +
-            pairs_by_fhs.get_stats()
-        );
-    }
-
-    // Send response anc close the connection.
-    void _send_response(const string& d, const string& code = "")
-    {
-        fh()->send(
-            "HTTP/1.0 " + (code.length()? code : "200 OK") + "\r\n" +
-            "Content-Type: text/plain\r\n" +
-            "Content-Length: " + lexical_cast<string>(d.length()) + "\r\n\r\n" +
-            d
-        );
-        fh()->shutdown(2);
-        pairs->clear();
-        rdata = "";
-    }
 };
 
+Realplexor::Event::Queue<InRequest>* In::queue = NULL;
+
 }
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,227 @@
+//@
+//@ Dklab Realplexor: Comet server which handles 1000000+ parallel browser connections
+//@ Author: Dmitry Koterov, dkLab (C)
+//@ License: GPL 2.0
+//@
+//@ 2025-* Contributor: Alexxiy
+//@ GitHub: http://github.com/alexxiy/
+//@
+//@ ATTENTION: Java-style C++ programming below. :-)
+//@
+//@ This is a line-by-line C++ rewrite of Perl prototype code with obvious speed
+//@ optimizations (like avoiding excess copies, config pre-parsing etc.).
+//@
+//@ The code is so compact (2600 lines) and so simple, that I decided not to
+//@ split it into *.hpp & *.cpp files nor create Makefiles, but place
+//@ everything into included *.h files (like Perl, Java, C# and most of other
+//@ languages do). It is not quite common for C++, but it surely simple
+//@ when a program is small (especially when it is rewritten line by line
+//@ from another language).
+//@
+//@ Also the code has global variables within the top namespace: one variable
+//@ per Storage and one CONFIG, they are like singletons.
+//@
+
+//
+// Binary publishing protocol (IN_BINARY_ADDR), an alternative to HTTP
+// on IN line: no headers and no regexes, just length-prefixed frames.
+// All integers are in network byte order.
+//
+// Request frame: [u32 length][u8 type][payload of length bytes], where:
+// - type 'L' (login, optional): [str login][str password];
+// - type 'P' (publish): [u64 cursor][u16 count]([str id] x count)
+//   [u16 count]([str limit_id] x count)[u32 length][data].
+// Here str is [u16 length][bytes], and zero cursor means "generate".
+//
+// Response frame (one per request, in the same order):
+// [u32 length][u8 status][text], where non-zero status means an error
+// (the connection is closed then) and the text is the same as HTTP
+// response body (e.g. "id cursor\n" lines for publishing).
+//
+
+#ifndef REALPLEXOR_CONNECTION_INBINARY_H
+#define REALPLEXOR_CONNECTION_INBINARY_H
+
+namespace Connection {
+using namespace Realplexor;
+using std::shared_ptr;
+using std::exception;
+
+class InBinary: public Realplexor::Event::Connection
+{
+    enum FrameType {
+        LOGIN = 'L',
+        PUBLISH = 'P',
+    };
+
+    string login;
+    bool authorized;
+
+public:
+
+    // Called on a new connection.
+    InBinary(fh_t fh, Realplexor::Event::ServerBase* server): Connection(fh, server), authorized(false) {}
+
+    // Hack: unfortunately C++ cannot call overriden virtual functions from base class destructors.
+    virtual ~InBinary()
+    {
+        ondestruct();
+    }
+
+    // Called when a data is available to read.
+    void onread(size_t nread)
+    {
+        Realplexor::Event::Connection::onread(nread);
+        size_t pos = 0;
+        size_t maxlen = CONFIG.locked(CONFIG.in_maxlen);
+        while (rdata.length() - pos >= 5) {
+            const char* p = rdata.data() + pos;
+            size_t len = _get_u32(p, p + 4);
+            if (len > maxlen) {
+                die("overflow (frame of " + lexical_cast<string>(len) + " bytes)");
+            }
+            if (rdata.length() - pos - 5 < len) break;
+            char type = *p++;
+            _process_frame(type, p, p + len);
+            pos += 5 + len;
+        }
+        rdata.erase(0, pos);
+    }
+
+    // Called on client side disconnect.
+    virtual void onclose()
+    {
+        // Incomplete frame (if any) is ignored.
+    }
+
+private:
+
+    // Processes a complete frame.
+    void _process_frame(char type, const char* p, const char* end)
+    {
+        if (type == LOGIN) {
+            login = _get_str(p, end);
+            string password = _get_str(p, end);
+            _authorize(password);
+            InRequest* req = _new_request();
+            req->cmd = "LOGIN";
+            In::submit(req);
+        } else if (type == PUBLISH) {
+            if (!authorized) _authorize("");
+            InRequest* req = _new_request();
+            try {
+                _parse_publish(req, p, end);
+            } catch (exception& e) {
+                delete req;
+                throw;
+            }
+            In::submit(req);
+        } else {
+            die("unknown frame type: " + lexical_cast<string>((int)type));
+        }
+    }
+
+    // Fills the request by data from a publish frame.
+    void _parse_publish(InRequest* req, const char* p, const char* end)
+    {
+        cursor_t cursor = _get_u64(p, end);
+        if (!cursor) cursor = Realplexor::Tools::time_hi_res();
+        auto checker = req->_id_prefixes_to_checker("");
+        for (size_t n = _get_u16(p, end); n > 0; n--) {
+            string id = _get_id(p, end);
+            // Check if it is not own pair.
+            if (!checker->matched(id)) {
+                DEBUG("skipping not owned [" + id + "] for login " + login);
+                continue;
+            }
+            req->pairs.push_back(DataPair(cursor, ident_t(id)));
+        }
+        req->limit_ids = make_local<RefLimitIdsSet>();
+        for (size_t n = _get_u16(p, end); n > 0; n--) {
+            req->limit_ids->insert(ident_t(_get_id(p, end)));
+        }
+        size_t len = _get_u32(p, end);
+        if ((size_t)(end - p) < len) die("malformed frame");
+        req->refdata = make_local<RefString>(p, len);
+    }
+
+    // Checks credentials; in case of error, the error response is sent
+    // and the connection is closed.
+    void _authorize(const string& password)
+    {
+        try {
+            Realplexor::Common::check_credentials(login, password);
+            authorized = true;
+        } catch (exception& e) {
+            InRequest* req = new InRequest(fh(), server(), login);
+            req->binary = true;
+            req->response = string(e.what()) + "\n";
+            req->code = "403 Access Deined";
+            In::submit(req);
+            throw;
+        }
+    }
+
+    // Creates a request answered within the same connection.
+    InRequest* _new_request()
+    {
+        InRequest* req = new InRequest(fh(), server(), login, true);
+        req->binary = true;
+        return req;
+    }
+
+    static void _need(const char* p, const char* end, size_t len)
+    {
+        if ((size_t)(end - p) < len) die("malformed frame");
+    }
+
+    static uint16_t _get_u16(const char*& p, const char* end)
+    {
+        _need(p, end, 2);
+        uint16_t v;
+        memcpy(&v, p, 2);
+        p += 2;
+        return ntohs(v);
+    }
+
+    static uint32_t _get_u32(const char*& p, const char* end)
+    {
+        _need(p, end, 4);
+        uint32_t v;
+        memcpy(&v, p, 4);
+        p += 4;
+        return ntohl(v);
+    }
+
+    static uint64_t _get_u64(const char*& p, const char* end)
+    {
+        _need(p, end, 8);
+        uint64_t v;
+        memcpy(&v, p, 8);
+        p += 8;
+        return be64toh(v);
+    }
+
+    static string _get_str(const char*& p, const char* end)
+    {
+        size_t len = _get_u16(p, end);
+        _need(p, end, len);
+        string s(p, len);
+        p += len;
+        return s;
+    }
+
+    // Same as _get_str(), but the result must be a valid identifier.
+    static string _get_id(const char*& p, const char* end)
+    {
+        string id = _get_str(p, end);
+        if (!id.length()) die("empty identifier");
+        for (char c: id) {
+            if (!isalnum((unsigned char)c) && c != '_') die("invalid identifier: " + id);
+        }
+        return id;
+    }
+};
+
+}
+#endif
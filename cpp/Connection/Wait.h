@@ -35,12 +35,13 @@ using std::shared_ptr;
 class Wait: public Realplexor::Event::Connection
 {
     shared_ptr<DataPairChain> pairs;
+    RequestParser parser;
     string _name;
 
 public:
     Wait(fh_t fh, Realplexor::Event::ServerBase* server): Connection(fh, server)
     {
-        pairs.reset(new DataPairChain());
+        pairs = make_slab_shared<DataPairChain>();
     }
 
     // Hack: unfortunately C++ cannot call overriden virtual functions from base class destructors.
@@ -55,18 +56,20 @@ public:
         Realplexor::Event::Connection::onread(nread);
 
         // Data must be ignored, identifier is already extracted.
-        if (pairs->size()) {
+        if (parser.identifier_found()) {
+            free_rdata();
             return;
         }
 
-        // Try to extract IDs from the new data chunk.
+        // Try to extract IDs from the new data chunk (only the newly
+        // received part is examined).
         Realplexor::LimitIdsSet limit_ids;
         Realplexor::CredPair cred;
-        if (Realplexor::Common::extract_pairs(rdata, *pairs, limit_ids, cred)) {
+        if (parser.extract_pairs(rdata, *pairs, limit_ids, cred)) {
             if (!pairs->size()) throw runtime_error("Empty identifier passed");
 
             // Check if we have special marker: SCRIPT.
-            if (pairs->begin()->id == CONFIG.script_id) {
+            if (pairs->begin()->id.str() == CONFIG.script_id) {
                 pairs->clear();
                 DEBUG("SCRIPT marker received, sending content");
                 Realplexor::Common::send_static(fh(), CONFIG.static_script.content, CONFIG.static_script.time, "text/javascript; charset=" + CONFIG.charset);
@@ -87,25 +90,14 @@ public:
             );
 
             // Ignore all other input from IN and register identifiers.
-            rdata = "";
+            free_rdata();
             pairs_by_fhs.set_pairs_for_fh(fh(), pairs);
             IdsToSendSet ids_to_process;
             for (auto& pair: *pairs) {
                 connected_fhs.add_to_id(pair.id, pair.cursor, fh());
-                // Create new online timer, but do not start it - it is
-                // started at LAST connection close, later.
-                string id = pair.id;
-                auto callback = [id]() {
-                    LOGGER("[" + id + "] is now offline");
-                    events.notify(DataEventType::OFFLINE, id);
-                    // It is better to change the order of upper two lines for more clear logging,
-                    // but it is already covered by auto-tests, so...
-                };
-                bool firstTime = online_timers.assign_stopped_timer_for_id<decltype(callback)>(id, callback);
-                if (firstTime) {
-                    // If above returned true, this ID was offline, but become online.
-                    events.notify(DataEventType::ONLINE, id);
-                }
+                // Mark ID as online (status of all workers is tracked
+                // by the main process).
+                workers.id_connected(pair.id);
                 ids_to_process.insert(pair.id);
             }
             DEBUG("registered"); // ids are already in the debug line prefix
@@ -137,9 +129,7 @@ public:
                 // Remove the client from all lists.
                 connected_fhs.del_from_id_by_fh(pair.id, fh());
                 // Turn on offline timer if it was THE LAST connection.
-                if (!connected_fhs.get_num_fhs_by_id(pair.id)) {
-                    online_timers.start_timer_by_id(pair.id, CONFIG.offline_timeout);
-                }
+                workers.id_disconnected(pair.id);
             }
         }
         pairs_by_fhs.remove_by_fh(fh());
@@ -149,7 +139,7 @@ public:
     virtual string name()
     {
         if (!_name.length() && pairs->size()) {
-            _name = lexical_cast<string>(pairs->begin()->cursor) + ":" + pairs->begin()->id +
+            _name = lexical_cast<string>(pairs->begin()->cursor) + ":" + pairs->begin()->id.str() +
                 (pairs->size() > 1? "(and " + lexical_cast<string>(pairs->size() - 1) + " more)" : "");
         }
         return _name;
@@ -35,9 +35,14 @@ class Common
 {
     // This is to execute a piece of code automatically.
     static Common instance;
+    static std::thread::id main_thread;
     Common()
     {
         CONFIG.set_logger(&logger);
+        main_thread = std::this_thread::get_id();
+        _deferred_sender.set<&Common::_send_deferred>();
+        _deferred_waker.set<&Common::_wake>();
+        _publisher.set<&Common::_send_published>();
     }
 
 public:
@@ -49,8 +54,11 @@ public:
     {
         int verb = CONFIG.verbosity;
         if (verb == 0) return;
+        static std::mutex mutex;
+        std::lock_guard<std::mutex> lock(mutex);
         string msg = s;
-        if (verb > 2) {
+        // Storages may be read within the main thread only.
+        if (verb > 2 && std::this_thread::get_id() == main_thread) {
             msg = msg + "\n  " +
                 "[pairs_by_fhs=" + lexical_cast<string>(pairs_by_fhs.get_num_items()) +
                 " data_to_send=" + lexical_cast<string>(data_to_send.get_num_items()) +
@@ -61,7 +69,7 @@ public:
                 "]";
         }
         if (verb >= 2) {
-            cout << "[" << strftime_std(from_time_t(ev::now(EV_DEFAULT))) << "] " << msg << endl;
+            cout << "[" << strftime_std(from_time_t(Realplexor::Tools::now())) << "] " << msg << endl;
         } else {
             cout << msg << endl;
         }
@@ -86,27 +94,17 @@ public:
     // - identifier=abc,def,*ghi,*jkl           [multiple ids, and (ghi, jkl) is returned as second list element]
     // - identifier=LOGIN:PASS@abc,10:def,*ghi  [same as above, but login and password are specified]
     //
+    // The data is searched from the position "from"; if the marker may
+    // be only partially received yet, "from" is moved to where the search
+    // must be resumed after more data arrives (see RequestParser).
+    //
     // Returns true if the extraction is succeeded.
-    static bool extract_pairs(string& data, DataPairChain& pairs, LimitIdsSet& limit_ids, Realplexor::CredPair& cred)
-    {
-        //
-        // TODO: this and derived functions must be strongly optimized.
-        //
-        // Return fast if no identifier marker is presented yet.
-        if (data.find(CONFIG.IDENTIFIER_PLUS_EQ) == data.npos) return false;
-
-        // Identifier marker seems to be presented. Remove referrer headers.
-        const char* start = data.c_str();
-        const char* p = strcasestr(start, "\nReferer:");
-        if (p) {
-            size_t pos = p - start + 1;
-            while (pos < data.length() && data[pos] != '\n') data[pos++] = ' ';
-        }
-
-        // Now check for identifier freely.
-        string ids;
-        if (!_extract_login_password_ids(data, cred, ids)) return false;
-        if (!_split_ids(ids, pairs, limit_ids)) return false;
+    static bool extract_pairs(const char* begin, const char* end, size_t& from, DataPairChain& pairs, LimitIdsSet& limit_ids, Realplexor::CredPair& cred)
+    {
+        const char* ids;
+        const char* ids_end;
+        if (!_extract_login_password_ids(begin, end, from, cred, ids, ids_end)) return false;
+        if (!_split_ids(ids, ids_end, pairs, limit_ids)) return false;
         return true;
     }
 
@@ -124,6 +122,34 @@ public:
         fh->shutdown(2); // don't use close, it breaks event machine!
     }
 
+    // Add data to ID queue and (re)start its cleanup timer.
+    static void push_data_to_id(const ident_t& id, cursor_t cursor, const DataRef& rdata, const LimitIdsRef& limit_ids)
+    {
+        data_to_send.add_dataref_to_id(id, cursor, rdata, limit_ids, CONFIG.max_data_for_id);
+        auto callback = [](const ident_t& id, int timeout) {
+            data_to_send.clear_id(id);
+            LOGGER("[" + id.str() + "] cleaned, because no data is pushed within last " + lexical_cast<string>(timeout) + " seconds");
+        };
+        cleanup_timers.start_timer_for_id(id, CONFIG.clean_id_after, callback);
+    }
+
+    // Mark ID as online: create new online timer, but do not start it -
+    // it is started at LAST connection close, later.
+    static void set_id_online(const ident_t& id)
+    {
+        auto callback = [](const ident_t& id, int) {
+            LOGGER("[" + id.str() + "] is now offline");
+            events.notify(DataEventType::OFFLINE, id);
+            // It is better to change the order of upper two lines for more clear logging,
+            // but it is already covered by auto-tests, so...
+        };
+        bool firstTime = online_timers.assign_stopped_timer_for_id(id, callback);
+        if (firstTime) {
+            // If above returned true, this ID was offline, but become online.
+            events.notify(DataEventType::ONLINE, id);
+        }
+    }
+
     // Send first pending data to clients with specified IDs.
     // Remove sent data from the queue and close connections to clients.
     template <class Cont>
@@ -132,19 +158,32 @@ public:
         // Remove old data; do it BEFORE data processing/sending. Why?
         // Because if we receive 1000 new data rows for the same ID,
         // they will all be sent to all connected clients and slow down
-        // the performance. When we clean the data before sending, we
-        // guarantee that the inner loop will have less than MAX_DATA_FOR_ID
-        // iterations for each ID.
+        // the performance. Queues are bounded when data is added, but
+        // MAX_DATA_FOR_ID may be decreased by config reload since then.
         for (auto& id: ids) {
             data_to_send.clean_old_data_for_id(id, CONFIG.max_data_for_id);
         }
 
-        // Collect data to be sent to each connection at data_by_fh.
-        // For each connection also collect matched IDs, so each client
-        // receives only the list of IDs which is matched by his request
-        // (client does not see IDs of other clients).
-        DataToSendByFh data_by_fh;
-        set<ident_t> seen_ids; // ordered - for logging
+        // Data for a huge number of connections is sent by slices
+        // during next event loop iterations.
+        if (CONFIG.fanout_slice) {
+            size_t num_fhs = 0;
+            for (auto& id: ids) num_fhs += connected_fhs.get_num_fhs_by_id(id);
+            if (num_fhs > CONFIG.fanout_slice) {
+                for (auto& id: ids) _defer(id);
+                return;
+            }
+        }
+
+        // Collect data to be sent to each connection: one element per
+        // connection, data item and ID (client receives only the list
+        // of IDs which is matched by his request, he does not see IDs of
+        // other clients). The list is reused, so it is not reallocated
+        // for each publish.
+        DataToSendChain to_send;
+        to_send.swap(_to_send);
+        to_send.clear();
+        vector<const ident_t*> seen_ids; // for logging
 
         // Iterate over all IDs to be checked.
         for (auto& id: ids) {
@@ -157,64 +196,108 @@ public:
             if (!fhs_hash.size()) continue;
 
             // Iterate over all connections which listen this ID.
+            size_t num_matched = to_send.size();
             for (const DataCursorFhByFh::value_type& cursor_and_fh: fhs_hash) {
-                // Process a single FH which listens this ID at listen_cursor.
-                cursor_t listen_cursor = cursor_and_fh.second.cursor;
-                fh_t fh = cursor_and_fh.second.fh;
-
-                // What other IDs are listened by this FH.
-                const DataPairChain& what_listens_this_fh = pairs_by_fhs.get_pairs_by_fh(fh);
-
-                // Iterate over data items.
-                for (const DataChunk& item: data) {
-                    // If we found an element with smaller cursor, abort iteration,
-                    // because all elements are sorted by cursor (bigger cursor first).
-                    if (item.cursor <= listen_cursor) break;
-
-                    // Process a single data item in context of this FH.
-                    const cursor_t&                cursor    = item.cursor;
-                    const shared_ptr<string>&      rdata     = item.rdata;
-                    const unordered_set<ident_t>&  limit_ids = *item.rlimit_ids;
-
-                    // Filter data invisible to this client.
-                    if (limit_ids.size()) {
-                        bool matched = false;
-                        for (auto& id_which_is_listened: what_listens_this_fh) {
-                            if (limit_ids.count(id_which_is_listened.id)) {
-                                matched = true;
-                                break;
-                            }
-                        }
-                        if (!matched) continue;
-                    }
+                // Deferred connection receives all its data later.
+                const fh_t& fh = cursor_and_fh.second.fh;
+                if (_deferred_fhs.size() && _deferred_fhs.count(fh.get())) continue;
+                _match(id, data, cursor_and_fh.second.cursor, fh, to_send);
+            }
+            if (to_send.size() > num_matched) seen_ids.push_back(&id);
+        }
 
-                    // Hash by dataref to avoid to send the same data
-                    // twice if it is appeared in multiple IDs.
-                    if (!data_by_fh.count(fh.get()) || !data_by_fh[fh.get()].count(rdata.get())) {
-                        DataToSendChunk& dts = data_by_fh[fh.get()][rdata.get()]; // it also creates this element
-                        dts.fh      = fh;
-                        dts.cursor  = cursor;
-                        dts.rdata   = rdata;
-                        dts.ids[id] = cursor;
-                    } else {
-                        // Add new ID to the list of IDs for this data.
-                        data_by_fh[fh.get()][rdata.get()].ids[id] = cursor;
-                    }
+        // Perform sending operation. Items of each connection are
+        // adjacent if a single ID is processed.
+        _do_send(to_send, ids.size() > 1, seen_ids);
+        to_send.swap(_to_send);
+    }
 
-                    // This is mostly for logging purposes.
-                    seen_ids.insert(id);
-                }
+    // Same as send_pendings(), but data is sent at the end of the
+    // current event loop iteration: all publishes received within one
+    // iteration are sent at once, so a client listening an ID receives
+    // all new data in a single response.
+    template <class Cont>
+    static void send_pendings_later(const Cont& ids)
+    {
+        for (auto& id: ids) {
+            if (_published_set.insert(id).second) _published.push_back(id);
+        }
+        if (_published.size() && !_publisher.is_active()) _publisher.start();
+    }
+
+    // Minimal number of connections to build responses in the pool.
+    static const size_t POOL_MIN_FHS = 256;
+
+    // Returns the number of connections waiting for deferred data.
+    static size_t get_num_deferred()
+    {
+        return _deferred.size();
+    }
+
+    // Croaks if login and password are not valid (empty login means
+    // guest access). May be called from the IN thread.
+    static void check_credentials(const string& login, const string& password)
+    {
+        std::lock_guard<std::mutex> lock(CONFIG.mutex);
+        if (login.length()) {
+            // Login + password are passed. Check credentials.
+            if (!CONFIG.users.count(login)) {
+                die("unknown login: " + login);
             }
+            string pwd_hash = CONFIG.users.get(login);
+            thread_local struct crypt_data crypt_buf;
+            if (crypt_r(password.c_str(), pwd_hash.c_str(), &crypt_buf) != pwd_hash) {
+                die("invalid password for login: " + login);
+            }
+        } else if (!CONFIG.users.count("")) {
+            // Guest access, but no guest account is found.
+            die("access denied for guest user");
         }
+    }
 
-        // Perform sending operation.
-        _do_send(data_by_fh, seen_ids);
+    // Extract records of a batch publish request starting from pos
+    // (after "BATCH" line). Format:
+    //   <ids> <length>\n
+    //   <data of length bytes>\n
+    //   <ids> <length>\n
+    //   ...
+    // where <ids> are in the same format as after "identifier=", but
+    // without login and password (e.g. "abc,12345:def,*ghi").
+    // Croaks if the data is malformed.
+    static void extract_batch_records(const string& data, size_t pos, DataRecordChain& records)
+    {
+        while (pos < data.length()) {
+            // Skip line feeds between records.
+            if (data[pos] == '\r' || data[pos] == '\n') {
+                pos++;
+                continue;
+            }
+            size_t eol = data.find('\n', pos);
+            if (eol == data.npos) die("batch record header is not finished");
+            size_t end = eol > pos && data[eol - 1] == '\r'? eol - 1 : eol;
+            string header = data.substr(pos, end - pos);
+            size_t space = header.rfind(' ');
+            size_t len = 0;
+            try {
+                if (space == header.npos) throw bad_lexical_cast();
+                len = lexical_cast<size_t>(header.substr(space + 1));
+            } catch (const bad_lexical_cast&) {
+                die("malformed batch record header: " + header);
+            }
+            if (len > data.length() - eol - 1) die("batch record data is truncated: " + header);
+            DataRecord record;
+            record.limit_ids = make_local<RefLimitIdsSet>();
+            _split_ids(header.data(), header.data() + space, record.pairs, *record.limit_ids);
+            record.rdata = make_local<RefString>(data, eol + 1, len);
+            records.push_back(record);
+            pos = eol + 1 + len;
+        }
     }
 
 private:
 
     // Shutdown a connection and remove all references to it.
-    static int _shutdown_fh(fh_t fh)
+    static int _shutdown_fh(const fh_t& fh)
     {
         // Remove all references to $fh from everywhere.
         for (auto& pair: pairs_by_fhs.get_pairs_by_fh(fh)) {
@@ -224,6 +307,201 @@ private:
         return fh->shutdown(2);
     }
 
+    // List of items to send reused by send_pendings().
+    static DataToSendChain _to_send;
+
+    // Connections are deferred in order of connected_fhs iteration, i.e.
+    // of their hashes: inserting keys in this order into a smaller table
+    // with the same hash clusters them, so another hash is used.
+    struct DeferredHash
+    {
+        size_t operator()(void* p) const
+        {
+            return reinterpret_cast<uintptr_t>(p) * 0xFF51AFD7ED558CCDull;
+        }
+    };
+
+    // Connections which receive data during next event loop iterations
+    // (in order) and references to them.
+    static ring<void*> _deferred;
+    static flat_map<void*, fh_t, DeferredHash> _deferred_fhs;
+    static ev::check _deferred_sender;
+    static ev::idle _deferred_waker;
+
+    // IDs published within the current event loop iteration. They are
+    // processed before the loop blocks (prepare watcher), i.e. after
+    // all ready connections are handled.
+    static vector<ident_t> _published;
+    static IdsToSendSet _published_set;
+    static ev::prepare _publisher;
+
+    static void _send_published(ev::prepare& w, int revents)
+    {
+        _publisher.stop();
+        vector<ident_t> ids;
+        ids.swap(_published);
+        _published_set.clear();
+        send_pendings(ids);
+    }
+
+    // Adds data items newer than listen_cursor which are visible to the
+    // fh listening the ID to the list of items to send.
+    static void _match(const ident_t& id, const DataChunkChain& data, cursor_t listen_cursor, const fh_t& fh, DataToSendChain& to_send)
+    {
+        // What other IDs are listened by this FH (looked up only if some
+        // data is limited).
+        const IdKeyChain* what_listens_this_fh = NULL;
+
+        // Iterate over data items newer than listen_cursor, the newest
+        // first (items are sorted by cursor, so the oldest of them is
+        // found by binary search).
+        size_t first = Storage::DataToSend::first_newer(data, listen_cursor);
+        for (size_t i = data.size(); i > first; i--) {
+            const DataChunk& item = data[i - 1];
+
+            // Filter data invisible to this client: both lists of IDs
+            // are sorted, so they are intersected by one pass.
+            const IdKeyChain& limit_ids = item.rlimit_ids->keys;
+            if (limit_ids.size()) {
+                if (!what_listens_this_fh) what_listens_this_fh = &pairs_by_fhs.get_keys_by_fh(fh);
+                if (!sorted_intersects(*what_listens_this_fh, limit_ids)) continue;
+            }
+
+            to_send.push_back({ fh.get(), &item, &id, to_send.size() });
+        }
+    }
+
+    // Queues connections which listen the ID and have data to receive.
+    // They are served by _send_deferred() once per event loop iteration
+    // (the idle watcher keeps the loop from blocking meanwhile).
+    static void _defer(const ident_t& id)
+    {
+        const DataChunkChain& data = data_to_send.get_data_by_id(id);
+        if (!data.size()) return;
+        for (const DataCursorFhByFh::value_type& cursor_and_fh: connected_fhs.get_hash_by_id(id)) {
+            const fh_t& fh = cursor_and_fh.second.fh;
+            if (cursor_and_fh.second.cursor >= data.back().cursor || _deferred_fhs.count(fh.get())) continue;
+            _deferred_fhs[fh.get()] = fh;
+            if (_deferred.full()) _deferred.reserve(std::max<size_t>(4, _deferred.capacity() * 2));
+            _deferred.push_back(fh.get());
+        }
+        if (_deferred.size() && !_deferred_sender.is_active()) {
+            _deferred_sender.start();
+            _deferred_waker.start();
+        }
+    }
+
+    // Sends data to the next slice of deferred connections. Each of them
+    // receives data of all IDs it listens, so it gets everything
+    // published while it was waiting in the queue, in order.
+    static void _send_deferred(ev::check& w, int revents)
+    {
+        DataToSendChain to_send;
+        to_send.swap(_to_send);
+        to_send.clear();
+        vector<const ident_t*> seen_ids; // for logging
+        size_t slice = CONFIG.fanout_slice? CONFIG.fanout_slice : _deferred.size();
+        for (size_t n = 0; n < slice && _deferred.size(); n++) {
+            void* key = _deferred.front();
+            _deferred.pop_front();
+            fh_t fh = std::move(_deferred_fhs[key]);
+            _deferred_fhs.erase(key);
+            // The connection may be already closed or served.
+            for (auto& pair: pairs_by_fhs.get_pairs_by_fh(fh)) {
+                size_t num_matched = to_send.size();
+                _match(pair.id, data_to_send.get_data_by_id(pair.id), pair.cursor, fh, to_send);
+                if (to_send.size() > num_matched) seen_ids.push_back(&pair.id);
+            }
+        }
+        _do_send(to_send, false, seen_ids);
+        to_send.swap(_to_send);
+        if (_deferred.empty()) {
+            _deferred_sender.stop();
+            _deferred_waker.stop();
+        }
+    }
+
+    static void _wake(ev::idle& w, int revents)
+    {
+    }
+
+    // Response shared by clients (see _do_send()). It may be built by
+    // a pool thread, so shared chunks are referenced by raw pointers
+    // (local_ptr counters are not thread-safe) and held by Storages.
+    struct Response
+    {
+        vector<const RefString*> parts;
+        vector<DataRef> fragments; // owned by this response
+        size_t num_chunks;
+        size_t length;
+        OutChunkChain out; // built by the main thread
+        Response(): num_chunks(0), length(0) {}
+    };
+
+    struct ResponseKeyHash
+    {
+        size_t operator()(const vector<uintptr_t>& key) const
+        {
+            size_t h = key.size();
+            for (uintptr_t v: key) h = (h ^ v) * 0x100000001B3;
+            return h;
+        }
+    };
+
+    // Builds responses for a range of connections. Clients which
+    // receive the same data for the same IDs (e.g. all listeners of
+    // a single ID) share one response.
+    struct Encoder
+    {
+        flat_map<vector<uintptr_t>, size_t, ResponseKeyHash> index; // response number + 1
+        vector<Response> responses;
+        vector<size_t> by_fh; // response number of each connection
+        vector<uintptr_t> key;
+        DataToSendChunkChain chunks;
+        IdCursorChain id_cursors;
+
+        // Items of each connection [starts[i], starts[i + 1]) must be
+        // already sorted.
+        void encode(const DataToSendItem* items, const size_t* starts, size_t num_fhs)
+        {
+            for (size_t i = 0; i < num_fhs; i++) {
+                _collect_chunks(items + starts[i], items + starts[i + 1], chunks, id_cursors);
+
+                // The response is identified by its data and IDs with cursors.
+                key.clear();
+                for (const DataToSendChunk& chunk: chunks) {
+                    key.push_back(reinterpret_cast<uintptr_t>(chunk.item->rdata.get()));
+                    key.push_back(chunk.ids_to - chunk.ids_from);
+                    for (size_t i = chunk.ids_from; i < chunk.ids_to; i++) {
+                        key.push_back(reinterpret_cast<uintptr_t>(id_cursors[i].first->key()));
+                        key.push_back(id_cursors[i].second);
+                    }
+                }
+                size_t& n = index[key];
+                if (!n) {
+                    responses.emplace_back();
+                    _build_response(chunks, id_cursors, responses.back());
+                    n = responses.size();
+                }
+                by_fh.push_back(n - 1);
+            }
+        }
+    };
+
+    // Returns the pool of ENCODE_THREADS threads or NULL if disabled.
+    static thread_pool* _encoding_pool()
+    {
+        static std::unique_ptr<thread_pool> pool;
+        size_t size = CONFIG.encode_threads;
+        if (!size) {
+            pool.reset();
+        } else if (!pool || pool->size() != size) {
+            pool.reset();
+            pool.reset(new thread_pool(size));
+        }
+        return pool.get();
+    }
+
     // Send data to each connection (json array format).
     // Response format is:
     // [
@@ -237,51 +515,187 @@ private:
     //   },
     //   ...
     // }
-    static void _do_send(DataToSendByFh& data_by_fh, std::set<ident_t>& seen_ids)
-    {
-        for (DataToSendByFh::value_type &pair: data_by_fh) {
-            std::vector<std::string> out_vec;
-
-            // Additional ordering by raw data is for better determinism in tests.
-            std::vector<DataToSendChunk*> triple_ptrs;
-            std::transform(
-                pair.second.begin(), pair.second.end(),
-                std::back_inserter(triple_ptrs),
-                [](DataToSendByDataRef::value_type& p) { return &p.second; }
-            );
-            std::sort(
-                triple_ptrs.begin(), triple_ptrs.end(),
-                [](DataToSendChunk* a, DataToSendChunk* b) {
-                    return a->cursor < b->cursor? true : (a->cursor > b->cursor? false : (*a->rdata < *b->rdata));
+    // If items are not grouped by connection (scattered), they are
+    // sorted as a whole, else only items of each connection are sorted.
+    static void _do_send(DataToSendChain& to_send, bool scattered, vector<const ident_t*>& seen_ids)
+    {
+        // The list of IDs is logged for each connection, so it is
+        // built once (and only if it is logged).
+        string from;
+        if (CONFIG.verbosity > 0) {
+            std::sort(seen_ids.begin(), seen_ids.end(), [](const ident_t* a, const ident_t* b) { return *a < *b; });
+            for (size_t i = 0; i < seen_ids.size(); i++) {
+                if (i > 0 && *seen_ids[i] == *seen_ids[i - 1]) continue;
+                from += (from.length()? ", " : "") + seen_ids[i]->str();
+            }
+        }
+
+        // Group items by connection, then by data (to avoid to send the
+        // same data twice if it is appeared in multiple IDs), keeping the
+        // order of matching within groups.
+        auto by_fh_and_data = [](const DataToSendItem& a, const DataToSendItem& b) {
+            if (a.fh != b.fh) return a.fh < b.fh;
+            if (a.item->rdata.get() != b.item->rdata.get()) return a.item->rdata.get() < b.item->rdata.get();
+            return a.seq < b.seq;
+        };
+        if (scattered) std::sort(to_send.begin(), to_send.end(), by_fh_and_data);
+        vector<size_t> starts;
+        for (size_t i = 0; i < to_send.size(); i++) {
+            if (!i || to_send[i].fh != to_send[i - 1].fh) starts.push_back(i);
+        }
+        size_t num_fhs = starts.size();
+        starts.push_back(to_send.size());
+        if (!num_fhs) return;
+
+        // Responses of big fan-outs are built by the pool, by ranges of
+        // connections. Pool threads only read Storages: fragments shared
+        // via DataChunk are encoded here beforehand.
+        const DataToSendItem* items = &to_send[0];
+        thread_pool* pool = num_fhs >= POOL_MIN_FHS? _encoding_pool() : NULL;
+        size_t num_tasks = pool? std::min(num_fhs, (pool->size() + 1) * 4) : 1;
+        vector<Encoder> encoders(num_tasks);
+        auto encode = [&](size_t task) {
+            size_t fh_from = num_fhs * task / num_tasks, fh_to = num_fhs * (task + 1) / num_tasks;
+            if (!scattered) {
+                for (size_t i = fh_from; i < fh_to; i++) {
+                    std::sort(to_send.begin() + starts[i], to_send.begin() + starts[i + 1], by_fh_and_data);
                 }
-            );
-
-            // Build JSON result.
-            for (DataToSendChunk* triple: triple_ptrs) {
-                // Build one response block.
-                // It's very important to send cursors as strings to avoid rounding.
-                std::vector<std::string> ids = map_to_vector(triple->ids, [](const std::pair<ident_t, cursor_t>& pair) { return "\"" + pair.first + "\": \"" + lexical_cast<std::string>(pair.second) + "\""; });
-                out_vec.push_back(
-                    "  {\n"
-                    "    \"ids\": { " + join(ids, ", ") + " },\n"
-                    "    \"data\":" + (triple->rdata->find("\n") != std::string::npos? "\n" : " ") + *triple->rdata + "\n"
-                    "  }"
+            }
+            encoders[task].encode(items, &starts[fh_from], fh_to - fh_from);
+        };
+        if (pool) {
+            for (const DataToSendItem& entry: to_send) {
+                if (entry.item->fragment) continue;
+                IdCursorChain::value_type id_cursor(entry.id, entry.item->cursor);
+                entry.item->fragment = _encode_fragment(&id_cursor, 1, *entry.item->rdata);
+            }
+            // A failed task (e.g. out of memory) is retried here, so an
+            // exception is handled as if there was no pool.
+            vector<char> failed(num_tasks, 0);
+            pool->run(num_tasks, [&](size_t task) {
+                try {
+                    encode(task);
+                } catch (...) {
+                    failed[task] = 1;
+                }
+            });
+            for (size_t task = 0; task < num_tasks; task++) {
+                if (!failed[task]) continue;
+                encoders[task] = Encoder();
+                encode(task);
+            }
+        } else {
+            encode(0);
+        }
+
+        size_t fh_index = 0;
+        for (Encoder& encoder: encoders) {
+            for (size_t n: encoder.by_fh) {
+                Response& response = encoder.responses[n];
+                if (response.out.empty()) {
+                    response.out.reserve(response.parts.size());
+                    for (const RefString* part: response.parts) response.out.push_back(local_ptr<const RefString>(part));
+                }
+
+                // Send response blocks as one "multipart". The fh is held
+                // here, because it is removed from Storages below.
+                fh_t fh = to_send[starts[fh_index++]].fh->shared_from_this();
+                int r1 = fh->sendv(response.out);
+                int r2 = _shutdown_fh(fh);
+                LOGGER(
+                    "<- sending " + lexical_cast<std::string>(response.num_chunks) + " responses " +
+                    "(" + lexical_cast<std::string>(response.length) + " bytes) from " +
+                    "[" + from + "] (print=" + lexical_cast<std::string>(r1) + ", shutdown=" + lexical_cast<std::string>(r2) + ")"
                 );
             }
+        }
+    }
+
+    // Collects response blocks from items of a single connection
+    // grouped by data. A block gets the cursor of the first matched
+    // item and, for each ID, the cursor of the last one.
+    static void _collect_chunks(const DataToSendItem* begin, const DataToSendItem* end, DataToSendChunkChain& chunks, IdCursorChain& id_cursors)
+    {
+        chunks.clear();
+        id_cursors.clear();
+        for (const DataToSendItem* p = begin, *q; p < end; p = q) {
+            for (q = p + 1; q < end && q->item->rdata.get() == p->item->rdata.get(); q++);
+            DataToSendChunk chunk = { p->item->cursor, p->item, id_cursors.size(), 0 };
+            for (const DataToSendItem* r = p; r < q; r++) {
+                id_cursors.push_back({ r->id, r->item->cursor });
+            }
+            if (q - p > 1) {
+                // IDs are listed in order, each one once.
+                auto from = id_cursors.begin() + chunk.ids_from;
+                std::stable_sort(from, id_cursors.end(), [](const IdCursorChain::value_type& a, const IdCursorChain::value_type& b) {
+                    return *a.first < *b.first;
+                });
+                auto out = from;
+                for (auto it = from; it != id_cursors.end(); ++it) {
+                    if (it + 1 != id_cursors.end() && *(it + 1)->first == *it->first) continue;
+                    *out++ = *it;
+                }
+                id_cursors.erase(out, id_cursors.end());
+            }
+            chunk.ids_to = id_cursors.size();
+            chunks.push_back(chunk);
+        }
+
+        // Additional ordering by raw data is for better determinism in tests.
+        std::sort(
+            chunks.begin(), chunks.end(),
+            [](const DataToSendChunk& a, const DataToSendChunk& b) {
+                return a.cursor < b.cursor? true : (a.cursor > b.cursor? false : (*a.item->rdata < *b.item->rdata));
+            }
+        );
+    }
 
-            // Join response blocks into one "multipart".
-            std::string out = "[\n" + join(out_vec, ",\n") + "\n]";
-            fh_t fh = pair.second.begin()->second.fh;
-            // Attention! We MUST use print, not syswrite, because print correctly
-            // continues broken transmits for large data packets.
-            int r1 = fh->send(out);
-            int r2 = _shutdown_fh(fh);
-            logger(
-                "<- sending " + lexical_cast<std::string>(out_vec.size()) + " responses " +
-                "(" + lexical_cast<std::string>(out.length()) + " bytes) from " +
-                "[" + join(seen_ids, ", ") + "] (print=" + lexical_cast<std::string>(r1) + ", shutdown=" + lexical_cast<std::string>(r2) + ")"
-            );
+    // Constant parts of responses. They are created by the main thread
+    // at startup, not within a pool thread which may be stopped.
+    static const DataRef _response_head;
+    static const DataRef _response_separator;
+    static const DataRef _response_tail;
+
+    // Builds JSON result. Nothing is copied: payloads and their fragments
+    // are passed by reference and written with writev() directly from
+    // the shared buffers.
+    static void _build_response(const DataToSendChunkChain& chunks, const IdCursorChain& id_cursors, Response& response)
+    {
+        vector<const RefString*>& parts = response.parts;
+        parts.reserve(chunks.size() * 3 + 1);
+        for (const DataToSendChunk& chunk: chunks) {
+            const DataChunk& item = *chunk.item;
+            const IdCursorChain::value_type* ids = &id_cursors[0] + chunk.ids_from;
+            size_t num_ids = chunk.ids_to - chunk.ids_from;
+            parts.push_back(parts.empty()? _response_head.get() : _response_separator.get());
+            if (num_ids == 1 && ids[0].second == item.cursor) {
+                // Data of a single ID: the fragment is encoded once.
+                if (!item.fragment) item.fragment = _encode_fragment(ids, num_ids, *item.rdata);
+                parts.push_back(item.fragment.get());
+            } else {
+                response.fragments.push_back(_encode_fragment(ids, num_ids, *item.rdata));
+                parts.push_back(response.fragments.back().get());
+            }
+            parts.push_back(item.rdata.get());
         }
+        parts.push_back(_response_tail.get());
+        response.num_chunks = chunks.size();
+        response.length = 0;
+        for (const RefString* part: parts) response.length += part->length();
+    }
+
+    // Encodes the beginning of a response block (before the data).
+    static DataRef _encode_fragment(const IdCursorChain::value_type* ids, size_t num_ids, const RefString& rdata)
+    {
+        // It's very important to send cursors as strings to avoid rounding.
+        DataRef fragment = make_local<RefString>("  {\n    \"ids\": { ");
+        for (size_t i = 0; i < num_ids; i++) {
+            if (i > 0) fragment->append(", ");
+            fragment->append("\"").append(ids[i].first->str()).append("\": \"");
+            fragment->append(lexical_cast<std::string>(ids[i].second)).append("\"");
+        }
+        fragment->append(" },\n    \"data\":").append(rdata.find('\n') != rdata.npos? "\n" : " ");
+        return fragment;
     }
 
 
@@ -290,48 +704,156 @@ private:
     //              ^^^^^ ^^^^ ^^^^^^^^^^^^^^^^
     // and also
     //   identifier=aaaa:4,bbb:5,...
-    static bool _extract_login_password_ids(const string& data, Realplexor::CredPair& cred, string& ids)
+    // This is a single-pass equivalent of the regular expression:
+    //   \bidentifier=(?:(\w+):([^@\s]+)@)?([*\w,.:]*)[^*\w,.:]
+    // (at the end, a character must follow IDs, NOT the end of the
+    // string, because only a chunk of the data may be received).
+    static bool _extract_login_password_ids(const char* begin, const char* end, size_t& from, Realplexor::CredPair& cred, const char*& ids, const char*& ids_end)
     {
-        boost::smatch m;
-        if (!regex_search(data, m, CONFIG.RE_LOGIN_PASSWORD_ID)) {
+        const string& marker = CONFIG.IDENTIFIER_PLUS_EQ;
+        std::string_view data(begin, end - begin);
+        size_t found;
+        for (found = data.find(marker, from); found != data.npos; found = data.find(marker, found + 1)) {
+            const char* p = begin + found;
+            // Word boundary before the marker.
+            if ((p > begin && _is_word(p[-1])) == _is_word(marker[0])) continue;
+            p += marker.length();
+            // Try with login and password first. If they may be not
+            // received completely yet, wait for more data (else the result
+            // would depend on how the data is split into chunks).
+            const char* login_end = _skip_word(p, end);
+            if (login_end > p && login_end < end && *login_end == ':') {
+                const char* password = login_end + 1;
+                const char* password_end = password;
+                while (password_end < end && *password_end != '@' && !isspace((unsigned char)*password_end)) password_end++;
+                if (password_end == end) break;
+                if (password_end > password && *password_end == '@') {
+                    ids = password_end + 1;
+                    ids_end = _skip_id_list(ids, end);
+                    if (ids_end == end) break;
+                    cred.login.assign(p, login_end);
+                    cred.password.assign(password, password_end);
+                    return true;
+                }
+            }
+            // Then without them.
+            ids = p;
+            ids_end = _skip_id_list(ids, end);
+            if (ids_end < end) {
+                cred.login.clear();
+                cred.password.clear();
+                return true;
+            }
+            // IDs reach the end of the data: all the rest belongs to
+            // them, so wait for more data.
+            break;
+        }
+        if (found != data.npos) {
+            // Resume from this marker when more data arrives.
+            from = found;
             return false;
         }
-        cred.login = m[1];
-        cred.password = m[2];
-        ids = m[3];
-        return true;
+        // No marker yet, but its beginning may be already received.
+        if (data.length() >= marker.length()) {
+            from = std::max(from, data.length() - marker.length() + 1);
+        }
+        return false;
     }
 
-    // Splits a comma-separated list of IDs.
-    static bool _split_ids(const string& ids, DataPairChain& pairs, LimitIdsSet& limit_ids)
+    // Splits a comma-separated list of IDs. Each element is in form of
+    // [*][cursor:]id, where cursor is \d+(\.\d+)? and id is \w+; invalid
+    // elements are skipped.
+    static bool _split_ids(const char* p, const char* end, DataPairChain& pairs, LimitIdsSet& limit_ids)
     {
         cursor_t time = 0;
-        size_t pos = 0;
-        while (pos < ids.length()) {
-            size_t comma = ids.find(',', pos);
-            if (comma == ids.npos) comma = ids.length();
-            boost::smatch m;
-            if (regex_search((ids.begin() + pos), (ids.begin() + comma), m, CONFIG.RE_CURSOR_ID)) {
-                if (m[1].length()) {
+        while (p < end) {
+            const char* comma = (const char*)memchr(p, ',', end - p);
+            if (!comma) comma = end;
+            const char* start = p;
+            bool limiter = *start == '*';
+            if (limiter) start++;
+            // Optional cursor.
+            const char* id = start;
+            const char* cursor_end = _skip_digits(start, comma);
+            if (cursor_end > start && cursor_end < comma && *cursor_end == '.') {
+                const char* fraction_end = _skip_digits(cursor_end + 1, comma);
+                cursor_end = fraction_end > cursor_end + 1? fraction_end : start;
+            }
+            if (cursor_end > start && cursor_end < comma && *cursor_end == ':') {
+                id = cursor_end + 1;
+            }
+            // ID itself.
+            if (id < comma && _skip_word(id, comma) == comma) {
+                if (limiter) {
                     // ID with limiter.
-                    limit_ids.insert(m[3]);
+                    limit_ids.emplace(id, comma);
                 } else {
                     // Not limiter or limiter, but in WAIT line.
-                    if (m[2].length()) {
+                    if (id > start) {
                         // with cursor
-                        pairs.push_back(Realplexor::DataPair(lexical_cast<cursor_t>(m[2]), m[3]));
+                        pairs.push_back(Realplexor::DataPair(_parse_cursor(start, id - 1), ident_t(id, comma)));
                     } else {
                         if (!time) time = Realplexor::Tools::time_hi_res();
-                        pairs.push_back(Realplexor::DataPair(time, m[3]));
+                        pairs.push_back(Realplexor::DataPair(time, ident_t(id, comma)));
                     }
                 }
             }
-            pos = comma + 1;
+            p = comma + 1;
         }
         return true;
     }
+
+    // Same as lexical_cast<cursor_t>: croaks on overflow and fractional
+    // cursors (they are allowed by the format, but not supported).
+    static cursor_t _parse_cursor(const char* p, const char* end)
+    {
+        cursor_t cursor = 0;
+        for (; p < end; p++) {
+            if (*p == '.') throw bad_lexical_cast();
+            cursor_t digit = *p - '0';
+            if (cursor > (std::numeric_limits<cursor_t>::max() - digit) / 10) throw bad_lexical_cast();
+            cursor = cursor * 10 + digit;
+        }
+        return cursor;
+    }
+
+    static bool _is_word(char c)
+    {
+        return isalnum((unsigned char)c) || c == '_';
+    }
+
+    static const char* _skip_word(const char* p, const char* end)
+    {
+        while (p < end && _is_word(*p)) p++;
+        return p;
+    }
+
+    static const char* _skip_digits(const char* p, const char* end)
+    {
+        while (p < end && isdigit((unsigned char)*p)) p++;
+        return p;
+    }
+
+    // Skips characters allowed in a list of IDs: [*\w,.:].
+    static const char* _skip_id_list(const char* p, const char* end)
+    {
+        while (p < end && (_is_word(*p) || *p == '*' || *p == ',' || *p == '.' || *p == ':')) p++;
+        return p;
+    }
 };
 
+std::thread::id Common::main_thread;
+DataToSendChain Common::_to_send;
+ring<void*> Common::_deferred;
+flat_map<void*, fh_t, Common::DeferredHash> Common::_deferred_fhs;
+ev::check Common::_deferred_sender;
+ev::idle Common::_deferred_waker;
+vector<ident_t> Common::_published;
+IdsToSendSet Common::_published_set;
+ev::prepare Common::_publisher;
+const DataRef Common::_response_head = make_local<RefString>("[\n");
+const DataRef Common::_response_separator = make_local<RefString>("\n  },\n");
+const DataRef Common::_response_tail = make_local<RefString>("\n  }\n]");
 Common Common::instance;
 
 }
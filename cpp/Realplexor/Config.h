@@ -42,12 +42,17 @@ class Config
     static inline void void_function(const string&) {}
 
 public:
-    int                          verbosity;
+    // Atomic: it is read without the lock by DEBUG() and the logger.
+    std::atomic<int>             verbosity;
     checked_map<string, string>  users;
     size_t                       max_data_for_id;
     string                       wait_addr;
     int                          wait_timeout;
+    int                          wait_workers;
+    size_t                       worker_outbuf_maxlen;
+    bool                         in_thread;
     string                       in_addr;
+    string                       in_binary_addr;
     int                          in_timeout;
     string                       su_user;
     double                       max_mem_mb;
@@ -56,13 +61,18 @@ public:
     int                          clean_id_after;
     string                       charset;
     size_t                       wait_maxlen;
+    size_t                       outbuf_maxlen;
+    size_t                       outbuf_total_maxlen;
+    size_t                       fanout_slice;
+    size_t                       encode_threads;
     int                          offline_timeout;
     string                       script_id;
     StaticFile                   static_script;
 
     string  IDENTIFIER_PLUS_EQ;
-    regex   RE_LOGIN_PASSWORD_ID;
-    regex   RE_CURSOR_ID;
+
+    // Guards options which are read by the IN thread against reloading.
+    std::mutex mutex;
 
     Config(): config("config"), users("users list")
     {
@@ -70,6 +80,15 @@ public:
         logger = (logger_t)Config::void_function; // default
     }
 
+    // Returns the value of an option read under the lock (e.g. by
+    // the IN thread while the main thread may reload the config).
+    template<class T>
+    T locked(const T& option)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return option;
+    }
+
     // Sets another logger routine for this config.
     void set_logger(logger_t l)
     {
@@ -98,14 +117,15 @@ public:
 
     // Returns "" if reloading is succeeded, else returns the name of
     // option which could not be reloaded.
-    string reload(string add)
+    string reload(string add, bool silent = false)
     {
-        regex lowlevel("^(WAIT_ADDR|WAIT_TIMEOUT|IN_ADDIN_TIMEOUT|SU_.*)$");
+        regex lowlevel("^(WAIT_ADDR|WAIT_TIMEOUT|WAIT_WORKERS|IN_THREAD|IN_BINARY_ADDR|IN_ADDIN_TIMEOUT|SU_.*)$");
         regex ignore("^(HOOK_|.*_CONTENT)$");
+        std::lock_guard<std::mutex> lock(mutex);
         // Load new config.
         auto old = config;
         try {
-            load(add);
+            load(add, silent);
         } catch (const std::exception &e) {
             logger(string("Error reloading config, continue with old settings: ") + e.what());
             config = old;
@@ -191,7 +211,11 @@ private:
         max_data_for_id = lexical_cast<size_t>(config.get("MAX_DATA_FOR_ID"));
         wait_addr = config.get("WAIT_ADDR");
         wait_timeout = lexical_cast<int>(config.get("WAIT_TIMEOUT"));
+        wait_workers = max(1, lexical_cast<int>(config.get("WAIT_WORKERS")));
+        worker_outbuf_maxlen = config.get<size_t>("WORKER_OUTBUF_MAXLEN");
+        in_thread = lexical_cast<int>(config.get("IN_THREAD")) != 0;
         in_addr = config.get("IN_ADDR");
+        in_binary_addr = config.get("IN_BINARY_ADDR");
         in_timeout = lexical_cast<int>(config.get("IN_TIMEOUT"));
         su_user = config.get("SU_USER");
         max_mem_mb = lexical_cast<double>(config.get("MAX_MEM_MB"));
@@ -200,22 +224,16 @@ private:
         clean_id_after = lexical_cast<int>(config.get("CLEAN_ID_AFTER"));
         charset = config.get("CHARSET");
         wait_maxlen = config.get<size_t>("WAIT_MAXLEN");
+        outbuf_maxlen = config.get<size_t>("OUTBUF_MAXLEN");
+        outbuf_total_maxlen = config.get<size_t>("OUTBUF_TOTAL_MAXLEN");
+        fanout_slice = config.get<size_t>("FANOUT_SLICE");
+        encode_threads = config.get<size_t>("ENCODE_THREADS");
         offline_timeout = lexical_cast<int>(config.get("OFFLINE_TIMEOUT"));
         script_id = config.get("SCRIPT_ID");
         _fill_static_file("SCRIPT", static_script);
 
         // Generate combined constant values for faster access.
         IDENTIFIER_PLUS_EQ = config.get("IDENTIFIER") + "=";
-        RE_LOGIN_PASSWORD_ID = regex(
-            "\\b" +
-            IDENTIFIER_PLUS_EQ +
-            "(?:(\\w+):([^@\\s]+)@)?" +
-            "([*\\w,.:]*)" +
-            // At the end, find a character, NOT the end of the string!
-            // Because only a chunk may finish, not the whole data.
-            "[^*\\w,.:]"
-        );
-        RE_CURSOR_ID = regex("^(\\*?)(?:(\\d+(?:\\.\\d+)?):)?(\\w+)$");
     }
 
     void _fill_static_file(const string& param, StaticFile& f)
@@ -63,6 +63,13 @@ public:
         return _fh->recv_and_append_to(rdata);
     }
 
+    // Clears the received data and frees its buffer (it is worth
+    // for long-living idle connections).
+    void free_rdata()
+    {
+        string().swap(rdata);
+    }
+
     // Called on close.
     virtual void onclose() =0;
 
@@ -108,6 +115,12 @@ public:
         return _fh;
     }
 
+    // Returns the server which accepted this connection.
+    ServerBase* server()
+    {
+        return _server;
+    }
+
     // Returns this connection name.
     virtual string name()
     {
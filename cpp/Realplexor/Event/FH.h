@@ -29,6 +29,13 @@
 // connection, even if this amount is larger than Unix socket buffers
 // (by default in Perl this buffer is near 160K, in C++ it's near 2K).
 //
+// Data which could not be written immediately is queued and drained by
+// an EV_WRITE watcher; shutdown() is postponed until the queue is empty.
+// Queued chunks are refcounted, so payloads shared by many connections
+// are written with writev() directly from the same memory.
+// While the queue is not empty, FH holds a reference to itself, so the
+// connection object may be destroyed before the client receives all data.
+//
 
 #ifndef REALPLEXOR_EVENT_FH_H
 #define REALPLEXOR_EVENT_FH_H
@@ -37,31 +44,124 @@ namespace Realplexor { namespace Event {
 using std::shared_ptr;
 using std::exception;
 
-class FH
+class FH: public std::enable_shared_from_this<FH>
 {
     shared_ptr<Socket> _sock;
 
+    // Queued output; _outpos is the offset of the first unsent byte
+    // within the front chunk, _buffered is the number of unsent bytes.
+    // The ring is allocated only while there is something to send (most
+    // connections never need it, and an empty deque is ~600 bytes).
+    ring<local_ptr<const RefString>> _outbuf;
+    size_t _outpos;
+    size_t _buffered;
+
+    // Postponed shutdown() mode (-1 if not requested).
+    int _shutdown_how;
+
+    // True if the connection is dropped and all output is discarded.
+    bool _broken;
+
+    // False if buffering limits are not applied to this connection.
+    bool _limited;
+
+    // Self-reference held while the output queue is not empty.
+    shared_ptr<FH> _self;
+
+    // Drains the queue; the timer drops clients which do not read data.
+    ev::io _write_watcher;
+    ev::timer _write_timer;
+
+    // Amount of unsent bytes within all connections.
+    static size_t _total_buffered;
+
 public:
-    FH(shared_ptr<Socket> sock): _sock(sock)
+    FH(shared_ptr<Socket> sock, int timeout = 0, bool limited = true):
+        _sock(sock), _outpos(0), _buffered(0), _shutdown_how(-1), _broken(false), _limited(limited)
     {
         _sock->blocking(false);
+        _write_watcher.set<FH, &FH::_on_writable>(this);
+        _write_watcher.set(_sock->fileno(), EV_WRITE);
+        _write_timer.set<FH, &FH::_on_write_timeout>(this);
+        _write_timer.set(0, timeout);
     }
 
-    virtual ~FH() {}
+    virtual ~FH()
+    {
+        // FH may be destroyed by a non-main thread when nothing is buffered.
+        if (_buffered) _total_buffered -= _buffered;
+    }
 
     size_t recv_and_append_to(string& s)
     {
         return _sock->recv_and_append_to(s);
     }
 
+    // Returns:
+    // - 1 if the data is sent or queued to be sent later
+    // - -1 if the connection is broken or buffer limits are exceeded
+    //   (the connection is dropped in this case)
     int send(const string& s)
     {
-        return _sock->send(s);
+        if (_broken) return -1;
+        size_t written = 0;
+        if (_outbuf.empty()) {
+            ssize_t n = _sock->write_some(s.data(), s.length());
+            if (n < 0) {
+                _drop();
+                return -1;
+            }
+            written = n;
+            if (written == s.length()) return 1;
+        }
+        size_t rest = s.length() - written;
+        if (!_can_buffer(rest)) return -1;
+        _enqueue(make_local<RefString>(s, written));
+        _start_draining(rest);
+        return 1;
+    }
+
+    // Sends a chain of buffers; buffers which could not be sent
+    // immediately are queued by reference, without copying.
+    // Return value is the same as for send().
+    int sendv(const OutChunkChain& chunks)
+    {
+        if (_broken) return -1;
+        size_t i = 0, offset = 0;
+        if (_outbuf.empty()) {
+            if (_writev(chunks, i, offset) < 0) {
+                _drop();
+                return -1;
+            }
+            if (i == chunks.size()) return 1;
+        }
+        size_t rest = 0;
+        for (size_t j = i; j < chunks.size(); j++) rest += chunks[j]->length();
+        rest -= offset;
+        if (!_can_buffer(rest)) return -1;
+        if (_outbuf.empty()) _outpos = offset;
+        for (; i < chunks.size(); i++) _enqueue(chunks[i]);
+        _start_draining(rest);
+        return 1;
     }
 
+    // Returns 0 on error, 1 on success. Writing side is shut down
+    // only after all queued data is sent.
     int shutdown(int how)
     {
-        return _sock->shutdown(how);
+        if (_outbuf.empty() || how == SHUT_RD) {
+            return _sock->shutdown(how);
+        }
+        if (how == SHUT_RDWR) _sock->shutdown(SHUT_RD);
+        _shutdown_how = how;
+        return 1;
+    }
+
+    // Stops reading. Only the socket is touched, so it may be called
+    // by the IN thread while the main loop sends data to the connection.
+    int shutdown_read()
+    {
+        return _sock->shutdown(SHUT_RD);
     }
 
     string peeraddr()
@@ -73,7 +173,138 @@ public:
     {
         return _sock->fileno();
     }
+
+    // Returns the number of bytes queued for this connection.
+    size_t get_buffered()
+    {
+        return _buffered;
+    }
+
+    // Returns the amount of unsent bytes within all connections.
+    static size_t get_total_buffered()
+    {
+        return _total_buffered;
+    }
+
+private:
+
+    // Writes queued chunks until the socket buffer is full.
+    void _on_writable(ev::io& w, int revents)
+    {
+        size_t i = 0;
+        ssize_t sent = _writev(_outbuf, i, _outpos);
+        if (sent < 0) {
+            _drop();
+            return;
+        }
+        while (i--) _outbuf.pop_front();
+        _buffered -= sent;
+        _total_buffered -= sent;
+        if (!_outbuf.empty()) {
+            if (sent && _write_timer.repeat) _write_timer.again();
+            return;
+        }
+        if (_shutdown_how >= 0) _sock->shutdown(_shutdown_how);
+        _release();
+    }
+
+    // Writes chunks starting from chunks[i] (skipping first offset bytes
+    // of it) until all of them are written or the socket buffer is full.
+    // Advances i and offset; returns the number of written bytes or -1.
+    template<class Chain>
+    ssize_t _writev(const Chain& chunks, size_t& i, size_t& offset)
+    {
+        const int max_iov = 64;
+        ssize_t total = 0;
+        while (i < chunks.size()) {
+            struct iovec iov[max_iov];
+            int cnt = 0;
+            size_t len = 0;
+            for (size_t j = i; j < chunks.size() && cnt < max_iov; j++, cnt++) {
+                size_t off = j == i? offset : 0;
+                iov[cnt].iov_base = const_cast<char*>(chunks[j]->data() + off);
+                iov[cnt].iov_len = chunks[j]->length() - off;
+                len += iov[cnt].iov_len;
+            }
+            ssize_t n = _sock->writev_some(iov, cnt);
+            if (n < 0) return -1;
+            total += n;
+            // Skip fully written chunks.
+            size_t left = n;
+            while (i < chunks.size() && left >= chunks[i]->length() - offset) {
+                left -= chunks[i]->length() - offset;
+                offset = 0;
+                i++;
+            }
+            offset += left;
+            if ((size_t)n < len) break;
+        }
+        return total;
+    }
+
+    void _enqueue(const local_ptr<const RefString>& chunk)
+    {
+        if (_outbuf.full()) _outbuf.reserve(std::max<size_t>(4, _outbuf.capacity() * 2));
+        _outbuf.push_back(chunk);
+    }
+
+    // Checks buffering limits; drops the connection if they are exceeded.
+    bool _can_buffer(size_t len)
+    {
+        if (!_limited) return true;
+        if (
+            (CONFIG.outbuf_maxlen && _buffered + len > CONFIG.outbuf_maxlen) ||
+            (CONFIG.outbuf_total_maxlen && _total_buffered + len > CONFIG.outbuf_total_maxlen)
+        ) {
+            _drop();
+            return false;
+        }
+        return true;
+    }
+
+    // Accounts len newly queued bytes and starts draining.
+    void _start_draining(size_t len)
+    {
+        _buffered += len;
+        _total_buffered += len;
+        if (!_self) {
+            _self = shared_from_this();
+            _write_watcher.start();
+            if (_write_timer.repeat) _write_timer.again();
+        }
+    }
+
+    // Called if the client does not read data for too long.
+    void _on_write_timeout(ev::timer& w, int revents)
+    {
+        _drop();
+    }
+
+    // Discards all queued data and closes the connection.
+    void _drop()
+    {
+        _broken = true;
+        _outbuf.reserve(0);
+        _outpos = 0;
+        _total_buffered -= _buffered;
+        _buffered = 0;
+        _sock->shutdown(SHUT_RDWR);
+        _release();
+    }
+
+    // Stops watchers and releases the self-reference (so this object
+    // may be destroyed here: do not touch members after the call).
+    void _release()
+    {
+        _outbuf.reserve(0);
+        _write_watcher.stop();
+        _write_timer.stop();
+        shared_ptr<FH> guard;
+        guard.swap(_self);
+    }
 };
 
+size_t FH::_total_buffered = 0;
+
 }}
 #endif
@@ -22,45 +22,53 @@
 //@ per Storage and one CONFIG, they are like singletons.
 //@
 
-#ifndef REALPLEXOR_EVENT_TIMER_H
-#define REALPLEXOR_EVENT_TIMER_H
+//
+// Measures pauses of the main event loop: the time spent in callbacks
+// within one loop iteration, from the return of the poll (when the loop
+// time is updated) to the next prepare. The longest pause is reported
+// by "STATS loop" (see Connection::In).
+//
 
-namespace Realplexor { namespace Event {
-
-class ITimer
-{
-public:
-    virtual void start(int timeout) =0;
-    virtual void remove() =0;
-    virtual ~ITimer() {}
-};
+#ifndef REALPLEXOR_EVENT_LOOPLAG_H
+#define REALPLEXOR_EVENT_LOOPLAG_H
 
+namespace Realplexor { namespace Event {
 
-template<typename Cb>
-class Timer: public ITimer
+class LoopLag
 {
-    ev0x::timer<Cb> w;
+    ev::prepare _w;
+    double _max_pause;
 
 public:
-
-    Timer(Cb handler): w(handler)
+    LoopLag(): _max_pause(0)
     {
-        w.set(0, 0);
+        _w.set<LoopLag, &LoopLag::_on_prepare>(this);
     }
 
-    void start(int timeout)
+    void start()
     {
-        w.set(timeout, 0);
-        w.start();
+        _w.start();
     }
 
-    void remove()
+    // Returns the longest pause (in seconds) since the previous call.
+    double take_max_pause()
     {
-        // Nothing: removed by destructor.
+        double max_pause = _max_pause;
+        _max_pause = 0;
+        return max_pause;
     }
 
-    virtual ~Timer() {}
+private:
+
+    void _on_prepare(ev::prepare& w, int revents)
+    {
+        double pause = ev_time() - ev_now(EV_DEFAULT);
+        if (pause > _max_pause) _max_pause = pause;
+    }
 };
 
 }}
+
+Realplexor::Event::LoopLag loop_lag;
+
 #endif
@@ -0,0 +1,80 @@
+//@
+//@ Dklab Realplexor: Comet server which handles 1000000+ parallel browser connections
+//@ Author: Dmitry Koterov, dkLab (C)
+//@ License: GPL 2.0
+//@
+//@ 2025-* Contributor: Alexxiy
+//@ GitHub: http://github.com/alexxiy/
+//@
+//@ ATTENTION: Java-style C++ programming below. :-)
+//@
+//@ This is a line-by-line C++ rewrite of Perl prototype code with obvious speed
+//@ optimizations (like avoiding excess copies, config pre-parsing etc.).
+//@
+//@ The code is so compact (2600 lines) and so simple, that I decided not to
+//@ split it into *.hpp & *.cpp files nor create Makefiles, but place
+//@ everything into included *.h files (like Perl, Java, C# and most of other
+//@ languages do). It is not quite common for C++, but it surely simple
+//@ when a program is small (especially when it is rewritten line by line
+//@ from another language).
+//@
+//@ Also the code has global variables within the top namespace: one variable
+//@ per Storage and one CONFIG, they are like singletons.
+//@
+
+//
+// Queue of objects passed to an event loop from other threads.
+//
+// Objects are put to a lock-free ring, and the loop is woken up by
+// ev_async; the handler is called from within the loop thread.
+//
+
+#ifndef REALPLEXOR_EVENT_QUEUE_H
+#define REALPLEXOR_EVENT_QUEUE_H
+
+namespace Realplexor { namespace Event {
+
+template<typename T>
+class Queue
+{
+public:
+    typedef void (*handler_t)(T* item);
+
+private:
+    mpsc_ring<T> ring;
+    handler_t handler;
+    ev::async w;
+
+public:
+
+    Queue(struct ev_loop* loop, handler_t handler, size_t size = 65536): ring(size), handler(handler), w(loop)
+    {
+        w.set<Queue<T>, &Queue<T>::invoke>(this);
+        w.start();
+    }
+
+    virtual ~Queue() {}
+
+    // May be called from any thread. If the ring is full, waits
+    // until the loop thread frees some space.
+    void push(T* item)
+    {
+        while (!ring.push(item)) {
+            w.send();
+            std::this_thread::yield();
+        }
+        w.send();
+    }
+
+private:
+
+    void invoke(ev::async& w, int revents)
+    {
+        while (T* item = ring.pop()) {
+            handler(item);
+        }
+    }
+};
+
+}}
+#endif
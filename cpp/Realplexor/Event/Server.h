@@ -39,6 +39,10 @@ protected:
     string name;
     logger_t logger;
 
+    // Descriptor reserved to accept (and close) connections when
+    // descriptors are exhausted. Shared by all servers and threads.
+    static std::atomic<int> reserve_fd;
+
 public:
     ServerBase(string name, logger_t logger): name(name), logger(logger) {}
 
@@ -77,16 +81,96 @@ public:
 template<class ConnClass>
 class Server: public ServerBase
 {
+    // Maximum number of connections accepted per one listener event.
+    static const int ACCEPT_BATCH = 256;
+
+    // Listener pause (seconds) when file descriptors are exhausted.
+    static constexpr double ACCEPT_PAUSE = 0.5;
+
+    // This holds all objects needed within listener event handlers.
+    struct Listener
+    {
+        shared_ptr<Socket>    sock;
+        shared_ptr<ev::io>    io;
+        shared_ptr<ev::timer> pause;
+        Server<ConnClass>*    server;
+
+        void handle(ev::io& w, int revents)
+        {
+            server->handle_accept(this);
+        }
+
+        void resume(ev::timer& w, int revents)
+        {
+            io->start();
+        }
+    };
+
+    // This holds all objects needed within connection event handlers.
+    // Unfortunately we cannot use C++0x closures, because captured vars
+    // are const, but we really need to destroy io event objects from
+    // within callbacks. So we use plain old structures, plain pointers
+    // and new/delete operators instead of shared_ptr.
+    struct IoClosure
+    {
+        ev::io                 io;
+        shared_ptr<ConnClass>  connection;
+        Server<ConnClass>*     server;
+        // Place in the list of connections ordered by activity.
+        IoClosure*             prev;
+        IoClosure*             next;
+        ev_tstamp              active;
+
+        IoClosure(struct ev_loop* loop): io(loop) {}
+
+        static void* operator new(size_t size)
+        {
+            return slab_allocator<IoClosure>().allocate(1);
+        }
+
+        static void operator delete(void* p)
+        {
+            slab_allocator<IoClosure>().deallocate(static_cast<IoClosure*>(p), 1);
+        }
+
+        void handle(ev::io& w, int revents)
+        {
+            if (server->handle_read(connection, revents)) {
+                server->touch(this);
+            } else {
+                server->destroy(this);
+            }
+        }
+    };
+
     vector<shared_ptr<ev::io>> events;
     string listen;
     int timeout;
     string connClass;
+    bool reuse_port;
+    struct ev_loop* loop;
+    size_t num_rejected;
+
+    // All connections have the same idle timeout, so instead of a timer
+    // per connection they are kept in a list ordered by the last activity
+    // time (the least active first). One timer is set to the timeout of
+    // the list head; when it fires, all expired connections are closed
+    // at once. Activity only moves a connection to the list tail.
+    IoClosure* idle_head;
+    IoClosure* idle_tail;
+    ev::timer idle_timer;
 
 public:
 
     // Creates a new server pool.
-    Server(string name, string listen, int timeout, logger_t logger): ServerBase(name, logger), listen(listen), timeout(timeout)
+    // Watchers are attached to the specified event loop; it may be run
+    // in a separate thread, but then ConnClass must care about it.
+    Server(string name, string listen, int timeout, logger_t logger, bool reuse_port = false, struct ev_loop* loop = EV_DEFAULT):
+        ServerBase(name, logger), listen(listen), timeout(timeout), reuse_port(reuse_port), loop(loop), num_rejected(0),
+        idle_head(NULL), idle_tail(NULL), idle_timer(loop)
     {
+        idle_timer.set<Server<ConnClass>, &Server<ConnClass>::handle_idle_timeout>(this);
+        if (reserve_fd < 0) reserve_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
         string lastAddr;
         try {
             for (auto& addr: split(" ", listen)) {
@@ -136,101 +220,166 @@ public:
         return true;
     }
 
-    // Called on a new connect.
-    void handle_connect(shared_ptr<Socket> sock)
-    {
-        shared_ptr<Socket> accepted(sock->accept());
-        fh_t fh(new Realplexor::Event::FH(accepted));
-        shared_ptr<ConnClass> connection(new ConnClass(fh, this));
-
-        // This holds all objects needed within event handlers.
-        // Unfortunately we cannot use C++0x closures, because captured vars
-        // are const, but we really need to destroy io and timer event objects
-        // from within callbacks. So we use plain old structures, plain pointers
-        // and new/delete operators instead of shared_ptr.
-        struct IoTimerClosure
-        {
-            shared_ptr<ev::io>     io;
-            shared_ptr<ev::timer>  timer;
-            shared_ptr<ConnClass>  connection;
-            Server<ConnClass>*     server;
-
-            void handle(int revents)
-            {
-                if (server->handle_read(connection, revents)) {
-                    timer->again();
+    // Called when a listening socket is readable: accepts pending
+    // connections until EAGAIN, but not more than ACCEPT_BATCH at once
+    // to let other watchers run.
+    void handle_accept(Listener* listener)
+    {
+        for (int i = 0; i < ACCEPT_BATCH; i++) {
+            shared_ptr<Socket> accepted(listener->sock->accept());
+            if (!accepted) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+                if (errno == EINTR || errno == ECONNABORTED || errno == EPROTO) continue;
+                if (errno == EMFILE || errno == ENFILE) {
+                    reject(listener);
                 } else {
-                    delete this;
+                    error(0, "ERROR calling accept(): " + string(strerror(errno)));
                 }
+                return;
             }
-
-            void handle(ev::io& w, int revents)
-            {
-                handle(revents);
+            try {
+                handle_connect(accepted);
+            } catch (exception& e) {
+                error(0, e.what());
             }
+        }
+    }
 
-            void handle(ev::timer& w, int revents)
-            {
-                handle(revents);
-            }
-        };
+    // Called when file descriptors are exhausted. The reserved descriptor
+    // is released to accept and close the pending connection (else
+    // the listener is signalled again and again, and the client hangs),
+    // then the listener is paused for a while.
+    void reject(Listener* listener)
+    {
+        string msg = strerror(errno);
+        int fd = reserve_fd.exchange(-1);
+        if (fd >= 0) {
+            close(fd);
+            fd = ::accept(listener->sock->fileno(), NULL, NULL);
+            if (fd >= 0) close(fd);
+            reserve_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        }
+        num_rejected++;
+        error(0,
+            "ERROR calling accept(): " + msg + "; " + lexical_cast<string>(num_rejected) +
+            " connection(s) rejected so far, pausing for " + lexical_cast<string>(ACCEPT_PAUSE) + " s"
+        );
+        listener->io->stop();
+        listener->pause->start();
+    }
+
+    // Returns the number of connections rejected because of
+    // file descriptors exhaustion.
+    size_t get_num_rejected()
+    {
+        return num_rejected;
+    }
+
+    // Called on a new connect.
+    void handle_connect(shared_ptr<Socket> accepted)
+    {
+        fh_t fh = make_slab_shared<Realplexor::Event::FH>(accepted, timeout);
+        shared_ptr<ConnClass> connection = make_slab_shared<ConnClass>(fh, this);
 
         // This object is deleted from within event handler callback.
-        IoTimerClosure *closure = new IoTimerClosure();
+        IoClosure *closure = new IoClosure(loop);
         closure->server = this;
         closure->connection = connection;
+        closure->prev = closure->next = NULL;
 
-        // Initialize IO event. When happens, this event restart Timer & IO events.
-        closure->io.reset(new ev::io());
-        closure->io->ev::io::set<IoTimerClosure, &IoTimerClosure::handle>(closure);
-        closure->io->ev::io::set(accepted->fileno(), EV_READ);
-        closure->io->start();
-
-        // Initialize Timer event. When happens, this event destroys Timer & IO event.
-        closure->timer.reset(new ev::timer());
-        closure->timer->ev::timer::set<IoTimerClosure, &IoTimerClosure::handle>(closure);
-        closure->timer->ev::timer::set(timeout, timeout);
-        closure->timer->start();
+        // Initialize IO event. When happens, this event restarts the idle timeout.
+        closure->io.ev::io::set<IoClosure, &IoClosure::handle>(closure);
+        closure->io.ev::io::set(accepted->fileno(), EV_READ);
+        closure->io.start();
+        touch(closure);
 
         // Leave closure along. It will be destroyed either by IO callback
-        // (when the data is finished) or by Timer callback.
+        // (when the data is finished) or by the idle timeout.
+    }
+
+    // Restarts the idle timeout of a connection.
+    void touch(IoClosure* closure)
+    {
+        _unlink(closure);
+        closure->active = ev_now(loop);
+        closure->prev = idle_tail;
+        (idle_tail? idle_tail->next : idle_head) = closure;
+        idle_tail = closure;
+        // Later activity never makes the head timeout earlier, so the
+        // timer is only started here (see handle_idle_timeout()).
+        if (!idle_timer.is_active()) {
+            idle_timer.set(timeout, 0);
+            idle_timer.start();
+        }
+    }
+
+    // Destroys a connection closure (and its io event).
+    void destroy(IoClosure* closure)
+    {
+        _unlink(closure);
+        delete closure;
+    }
+
+    // Called when the list head may be expired: closes all connections
+    // which are idle for timeout seconds and waits for the next one.
+    void handle_idle_timeout(ev::timer& w, int revents)
+    {
+        ev_tstamp now = ev_now(loop);
+        while (idle_head && idle_head->active + timeout <= now) {
+            IoClosure* closure = idle_head;
+            _unlink(closure);
+            handle_read(closure->connection, EV_TIMEOUT);
+            delete closure;
+        }
+        if (idle_head) {
+            idle_timer.set(idle_head->active + timeout - now, 0);
+            idle_timer.start();
+        }
     }
 
     // Adds a new listen address to the pool.
     // Croaks in case of error.
     shared_ptr<ev::io> add_listen(string addr)
     {
-        shared_ptr<Socket> sock(new Socket(addr));
+        shared_ptr<Socket> sock(new Socket(addr, reuse_port));
         sock->blocking(false);
 
-        // This holds all objects needed within event handlers.
-        struct IoClosure
-        {
-            shared_ptr<Socket> sock;
-            Server<ConnClass>* server;
-            void handle(ev::io& w, int revents)
-            {
-                server->handle_connect(sock);
-            }
-        };
-
         // This object is NEVER deleted (we assume that Server object lives forever).
-        IoClosure* closure = new IoClosure();
-        closure->server = this;
-        closure->sock = sock;
+        Listener* listener = new Listener();
+        listener->server = this;
+        listener->sock = sock;
 
         // Create an event and return it.
-        shared_ptr<ev::io> evt(new ev::io());
-        evt->ev::io::set<IoClosure, &IoClosure::handle>(closure);
+        shared_ptr<ev::io> evt(new ev::io(loop));
+        evt->ev::io::set<Listener, &Listener::handle>(listener);
         evt->ev::io::set(sock->fileno(), EV_READ);
         evt->start();
+        listener->io = evt;
+
+        // This event resumes the paused listener.
+        listener->pause.reset(new ev::timer(loop));
+        listener->pause->ev::timer::set<Listener, &Listener::resume>(listener);
+        listener->pause->ev::timer::set(ACCEPT_PAUSE, 0);
 
         message(0, "listening " + addr);
         return evt;
     }
 
+private:
+
+    void _unlink(IoClosure* closure)
+    {
+        if (closure->prev || idle_head == closure) {
+            (closure->prev? closure->prev->next : idle_head) = closure->next;
+            (closure->next? closure->next->prev : idle_tail) = closure->prev;
+        }
+        closure->prev = closure->next = NULL;
+    }
+
 };
 
+std::atomic<int> ServerBase::reserve_fd(-1);
+
 void mainloop()
 {
     ev_loop(EV_DEFAULT_ 0);
@@ -0,0 +1,138 @@
+//@
+//@ Dklab Realplexor: Comet server which handles 1000000+ parallel browser connections
+//@ Author: Dmitry Koterov, dkLab (C)
+//@ License: GPL 2.0
+//@
+//@ 2025-* Contributor: Alexxiy
+//@ GitHub: http://github.com/alexxiy/
+//@
+//@ ATTENTION: Java-style C++ programming below. :-)
+//@
+//@ This is a line-by-line C++ rewrite of Perl prototype code with obvious speed
+//@ optimizations (like avoiding excess copies, config pre-parsing etc.).
+//@
+//@ The code is so compact (2600 lines) and so simple, that I decided not to
+//@ split it into *.hpp & *.cpp files nor create Makefiles, but place
+//@ everything into included *.h files (like Perl, Java, C# and most of other
+//@ languages do). It is not quite common for C++, but it surely simple
+//@ when a program is small (especially when it is rewritten line by line
+//@ from another language).
+//@
+//@ Also the code has global variables within the top namespace: one variable
+//@ per Storage and one CONFIG, they are like singletons.
+//@
+
+//
+// Coarse-grained timing wheel: timeouts of many IDs are rounded up to
+// TICK and expired by a single libev periodic watcher (which fires at
+// multiples of TICK, so an ID expires at most TICK late); arming a timeout
+// allocates nothing and does not touch libev at all.
+//
+// A client keeps expiry times of its IDs itself and only schedules an
+// ID at some tick: when the tick comes, client's on_tick() decides what
+// to do (the timer could be stopped or moved to a later time since then,
+// so re-arming to a later time needs no wheel operation).
+//
+
+#ifndef REALPLEXOR_EVENT_TIMERWHEEL_H
+#define REALPLEXOR_EVENT_TIMERWHEEL_H
+
+namespace Realplexor { namespace Event {
+
+class TimerWheel
+{
+public:
+    typedef unsigned long tick_t;
+
+    class IClient
+    {
+    public:
+        virtual void on_tick(const ident_t& id, tick_t tick) =0;
+        virtual ~IClient() {}
+    };
+
+    // Timer resolution (in seconds).
+    static constexpr double TICK = 0.1;
+
+private:
+    // Number of slots (a power of 2). An ID scheduled more than SLOTS
+    // ticks later stays in its slot for several rounds.
+    static const size_t SLOTS = 1024;
+
+    struct Item
+    {
+        IClient* client;
+        ident_t id;
+        tick_t tick;
+    };
+
+    vector<Item> _slots[SLOTS];
+    size_t _size;
+    tick_t _swept; // all ticks up to this one are processed
+    ev::periodic _timer;
+
+public:
+
+    TimerWheel(): _size(0), _swept(0)
+    {
+        _timer.set<TimerWheel, &TimerWheel::_on_timer>(this);
+    }
+
+    // Returns the tick when a timeout started now expires.
+    tick_t tick_after(double timeout)
+    {
+        return (tick_t)ceil((ev::now(EV_DEFAULT) + timeout) / TICK);
+    }
+
+    // Calls client->on_tick(id, tick) at the tick (or at the next one
+    // if it is already passed). Returns the tick actually used.
+    tick_t schedule(IClient* client, const ident_t& id, tick_t tick)
+    {
+        if (!_size) {
+            // Nothing is pending: start sweeping from now.
+            _swept = std::max(_swept, _now());
+            if (!_timer.is_active()) _timer.start(0, TICK);
+        }
+        if (tick <= _swept) tick = _swept + 1;
+        _slots[tick & (SLOTS - 1)].push_back(Item{client, id, tick});
+        _size++;
+        return tick;
+    }
+
+    size_t size()
+    {
+        return _size;
+    }
+
+private:
+
+    tick_t _now()
+    {
+        return (tick_t)(ev::now(EV_DEFAULT) / TICK);
+    }
+
+    void _on_timer(ev::periodic& w, int revents)
+    {
+        tick_t now = _now();
+        while (_swept < now && _size) {
+            _swept++;
+            vector<Item>& slot = _slots[_swept & (SLOTS - 1)];
+            if (slot.empty()) continue;
+            // Clients may schedule IDs while being called.
+            vector<Item> items;
+            items.swap(slot);
+            for (auto& item: items) {
+                if (item.tick > _swept) {
+                    slot.push_back(std::move(item)); // one of the next rounds
+                    continue;
+                }
+                _size--;
+                item.client->on_tick(item.id, item.tick);
+            }
+        }
+        if (!_size) _timer.stop();
+    }
+};
+
+}}
+#endif
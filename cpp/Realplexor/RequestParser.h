@@ -0,0 +1,263 @@
+//@
+//@ Dklab Realplexor: Comet server which handles 1000000+ parallel browser connections
+//@ Author: Dmitry Koterov, dkLab (C)
+//@ License: GPL 2.0
+//@
+//@ 2025-* Contributor: Alexxiy
+//@ GitHub: http://github.com/alexxiy/
+//@
+//@ ATTENTION: Java-style C++ programming below. :-)
+//@
+//@ This is a line-by-line C++ rewrite of Perl prototype code with obvious speed
+//@ optimizations (like avoiding excess copies, config pre-parsing etc.).
+//@
+//@ The code is so compact (2600 lines) and so simple, that I decided not to
+//@ split it into *.hpp & *.cpp files nor create Makefiles, but place
+//@ everything into included *.h files (like Perl, Java, C# and most of other
+//@ languages do). It is not quite common for C++, but it surely simple
+//@ when a program is small (especially when it is rewritten line by line
+//@ from another language).
+//@
+//@ Also the code has global variables within the top namespace: one variable
+//@ per Storage and one CONFIG, they are like singletons.
+//@
+
+//
+// Resumable parser of IN and WAIT requests.
+//
+// A request is received chunk by chunk and appended to the connection
+// buffer; the parser remembers how far it got, so each byte is examined
+// once however many chunks arrive. Requests are HTTP-like (header lines,
+// an empty line and a body), but raw data (e.g. "ONLINE\n") is accepted
+// too. Parser methods always receive the same (growing) buffer; reset()
+// must be called when the buffer is replaced.
+//
+
+#ifndef REALPLEXOR_REQUEST_PARSER_H
+#define REALPLEXOR_REQUEST_PARSER_H
+
+namespace Realplexor {
+
+class RequestParser
+{
+    // Commands which may start the data or the body.
+    static constexpr const char* COMMANDS[] = { "ONLINE", "STATS", "WATCH", "BATCH" };
+
+    // Command detection state at some position: -1 if not known yet,
+    // 0 if there is no command, else 1 + index in COMMANDS.
+    struct CommandState {
+        int command;
+        size_t eol_from;
+    };
+
+    // Header lines are examined up to this position (within the body
+    // it is the length of the data).
+    size_t _pos;
+    size_t _line_start;
+    bool _blanking;
+    size_t _body;
+    bool _keep_alive;
+    size_t _content_length;
+    size_t _identifier_from;
+    bool _identifier_found;
+    CommandState _commands[2];
+
+public:
+    RequestParser()
+    {
+        reset();
+    }
+
+    // Starts parsing of a new request.
+    void reset()
+    {
+        _pos = 0;
+        _line_start = 0;
+        _blanking = false;
+        _body = string::npos;
+        _keep_alive = false;
+        _content_length = string::npos;
+        _identifier_from = 0;
+        _identifier_found = false;
+        _commands[0] = _commands[1] = { -1, 0 };
+    }
+
+    // Examines newly received header lines: Referer headers are blanked
+    // (they may contain an identifier marker of another page), keep-alive
+    // headers are remembered and the body start is detected.
+    void feed(string& data)
+    {
+        size_t len = data.length();
+        while (_body == string::npos && _pos < len) {
+            if (_pos == _line_start && _line_start > 0 && !_blanking) {
+                int referer = _match_header(data, _line_start, "Referer:");
+                if (referer < 0) return; // wait for more data
+                _blanking = referer > 0;
+            }
+            const char* eol = (const char*)memchr(data.data() + _pos, '\n', len - _pos);
+            size_t end = eol? eol - data.data() : len;
+            if (_blanking) memset(&data[_pos], ' ', end - _pos);
+            _pos = end;
+            if (!eol) return;
+            _on_header_line(data, _line_start, end);
+            _pos = _line_start = end + 1;
+            _blanking = false;
+        }
+        _pos = len;
+    }
+
+    // Extracts pairs (see Common::extract_pairs()) from the data received
+    // so far. Returns true only once, when the identifier is found.
+    bool extract_pairs(string& data, DataPairChain& pairs, LimitIdsSet& limit_ids, CredPair& cred)
+    {
+        feed(data);
+        if (_identifier_found) return false;
+        const char* begin = data.data();
+        _identifier_found = Common::extract_pairs(begin, begin + std::min(_pos, data.length()), _identifier_from, pairs, limit_ids, cred);
+        return _identifier_found;
+    }
+
+    // Returns true if the identifier has been already found.
+    bool identifier_found()
+    {
+        return _identifier_found;
+    }
+
+    // Returns the body start or string::npos if headers are not
+    // received completely yet.
+    size_t body(string& data)
+    {
+        feed(data);
+        return _body;
+    }
+
+    // Returns the length of the first keep-alive request (its headers
+    // contain "Connection: keep-alive" and Content-Length) or
+    // string::npos if there is no such complete request yet.
+    size_t keep_alive_length(string& data)
+    {
+        feed(data);
+        if (_body == string::npos || !_keep_alive || _content_length == string::npos) return string::npos;
+        if (data.length() - _body < _content_length) return string::npos;
+        return _body + _content_length;
+    }
+
+    // Returns true if the headers declare Content-Length, but the body
+    // is not received completely.
+    bool truncated(string& data)
+    {
+        feed(data);
+        return _body != string::npos && _content_length != string::npos && data.length() - _body < _content_length;
+    }
+
+    // Detects a command at the start of the data or of the body:
+    //   (ONLINE|STATS|WATCH)[ arg]\n\n
+    //   BATCH\n<records starting from pos>
+    // Unless finished, the command line must be followed by an empty
+    // line. BATCH is reported as soon as its line is received, so the
+    // caller must wait for the whole data itself.
+    bool command(string& data, bool finished, string& cmd, string& arg, size_t& pos)
+    {
+        feed(data);
+        size_t len = data.length();
+        for (int i = 0; i < 2; i++) {
+            size_t start = i? _body : 0;
+            if (start == string::npos) break;
+            CommandState& state = _commands[i];
+            if (state.command < 0) state.command = _match_command(data, start, finished);
+            if (state.command <= 0) continue;
+            const string name = COMMANDS[state.command - 1];
+            bool batch = name == "BATCH";
+            // Find the end of the command line (once).
+            size_t args = start + name.length();
+            size_t eol = data.find('\n', std::max(args, state.eol_from));
+            if (eol == string::npos) {
+                state.eol_from = len;
+                if (!finished || batch) continue;
+                eol = len;
+            } else {
+                state.eol_from = eol;
+            }
+            size_t line_end = eol > args && data[eol - 1] == '\r'? eol - 1 : eol;
+            if (batch) {
+                if (data.find_first_not_of(" \t", args) < line_end) {
+                    state.command = 0;
+                    continue;
+                }
+            } else if (!finished) {
+                // An empty line must follow.
+                size_t p = eol + 1;
+                if (p < len && data[p] == '\r') p++;
+                if (p >= len || data[p] != '\n') continue;
+            }
+            while (args < line_end && isspace((unsigned char)data[args])) args++;
+            cmd = name;
+            arg.assign(data, args, line_end - args);
+            pos = std::min(eol + 1, len);
+            return true;
+        }
+        return false;
+    }
+
+private:
+
+    // Called for each complete header line [start, eol) (eol is "\n").
+    void _on_header_line(const string& data, size_t start, size_t eol)
+    {
+        size_t end = eol > start && data[eol - 1] == '\r'? eol - 1 : eol;
+        if (end == start) {
+            _body = eol + 1;
+            return;
+        }
+        if (_match_header(data, start, "Connection:") > 0) {
+            if (_header_value(data, start + strlen("Connection:"), end) == "keep-alive") {
+                _keep_alive = true;
+            }
+        } else if (_match_header(data, start, "Content-Length:") > 0 && _content_length == string::npos) {
+            string value = _header_value(data, start + strlen("Content-Length:"), end);
+            if (value.length() && value.find_first_not_of("0123456789") == string::npos) {
+                _content_length = lexical_cast<size_t>(value);
+            }
+        }
+    }
+
+    // Returns lowercased header value without surrounding spaces.
+    static string _header_value(const string& data, size_t start, size_t end)
+    {
+        while (start < end && (data[start] == ' ' || data[start] == '\t')) start++;
+        while (end > start && isspace((unsigned char)data[end - 1])) end--;
+        return to_lower_copy(data.substr(start, end - start));
+    }
+
+    // Returns 1 if the line at start begins with the header name
+    // (case-insensitive), 0 if not and -1 if not enough data yet.
+    static int _match_header(const string& data, size_t start, const char* name)
+    {
+        size_t avail = data.length() - start;
+        size_t n = strlen(name);
+        if (strncasecmp(data.data() + start, name, std::min(avail, n))) return 0;
+        return avail < n? -1 : 1;
+    }
+
+    // Returns the command state for the given position.
+    static int _match_command(const string& data, size_t start, bool finished)
+    {
+        size_t avail = data.length() - start;
+        for (size_t i = 0; i < sizeof(COMMANDS) / sizeof(COMMANDS[0]); i++) {
+            size_t n = strlen(COMMANDS[i]);
+            if (strncasecmp(data.data() + start, COMMANDS[i], std::min(avail, n))) continue;
+            if (avail > n) {
+                // Command must be followed by a space.
+                if (isspace((unsigned char)data[start + n])) return i + 1;
+            } else if (!finished) {
+                return -1;
+            } else if (avail == n) {
+                return i + 1;
+            }
+        }
+        return 0;
+    }
+};
+
+}
+#endif
@@ -31,16 +31,30 @@ class Tools
 {
 public:
 
+    // Event loop of the current thread, if it is not the default one
+    // (the default loop may not be touched by the IN thread).
+    static thread_local struct ev_loop* loop;
+
+    // Returns the time of the current thread's event loop.
+    static ev_tstamp now()
+    {
+        return ev_now(loop? loop : EV_DEFAULT);
+    }
+
     // Return HiRes time. It is guaranteed that two sequencial calls
-    // of this function always return different time, second > first.
+    // of this function always return different time, second > first:
+    // within one loop iteration (e.g. for pipelined publishes) cursors
+    // are incremented, so they never go backwards.
     static cursor_t time_hi_res()
     {
-        cursor_t time = static_cast<cursor_t>(ev::now(EV_DEFAULT) * 10000);
-        static int time_counter = 0;
-        const int cycle = 1000;
-        time_counter++;
-        if (time_counter > cycle) time_counter = 0;
-        return time * 10000 + time_counter;
+        cursor_t time = static_cast<cursor_t>(now() * 10000) * 10000;
+        // Atomic, because it is also called from the IN thread.
+        static std::atomic<cursor_t> last(0);
+        cursor_t prev = last.load(std::memory_order_relaxed), next;
+        do {
+            next = std::max(prev + 1, time);
+        } while (!last.compare_exchange_weak(prev, next, std::memory_order_relaxed));
+        return next;
     }
 
     // Rerun the script unlimited.
@@ -66,38 +80,65 @@ public:
         }
     }
 
-    // Returns amount of used memory by pid (in megabytes).
-    static double get_memory_usage(pid_t pid)
+    // Returns amounts of used memory (in megabytes) by pid and by its
+    // descendants (WAIT workers and their spawner):
+    // [ [pid1, mb1], [pid2, mb2], ... ].
+    static vector<std::pair<pid_t, double>> get_memory_usage(pid_t pid)
     {
-        string mem = backtick(
-            "ps -p " + lexical_cast<string>(pid) + " -o rss "
-#ifdef __APPLE__
-    "| awk 'NR>1'"
-#else
-    "--no-headers"
-#endif
-        );
-        mem = regex_replace(mem, regex("\\s+"), "");
-        if (mem == "") return 0;
-        return lexical_cast<double>(mem) / 1024;
+        vector<std::pair<pid_t, double>> result;
+        string ps = trim_copy(backtick("ps -A -o pid= -o ppid= -o rss="));
+        if (ps == "") return result;
+        vector<string> fields = split(regex("\\s+"), ps);
+        // Children may be listed before parents (pids wrap), so the list
+        // is scanned until nothing is added.
+        std::set<pid_t> pids = { pid };
+        for (size_t added = 1; added; ) {
+            added = 0;
+            for (size_t i = 0; i + 2 < fields.size(); i += 3) {
+                pid_t p = lexical_cast<pid_t>(fields[i]);
+                if (pids.count(lexical_cast<pid_t>(fields[i + 1])) && pids.insert(p).second) added++;
+            }
+        }
+        for (size_t i = 0; i + 2 < fields.size(); i += 3) {
+            pid_t p = lexical_cast<pid_t>(fields[i]);
+            if (!pids.count(p)) continue;
+            result.push_back(std::make_pair(p, lexical_cast<double>(fields[i + 2]) / 1024));
+        }
+        return result;
     }
 
     // Wait for a process termination.
-    // If the process limits memory usage, kills it.
+    // If the process exceeds the memory limit, kills it. If one of its
+    // WAIT workers (each one has its own Storages) exceeds the limit,
+    // kills the worker only: the process restarts it.
     static void wait_pid_with_memory_limit(pid_t pid, double limit)
     {
         int status;
         while (waitpid(pid, &status, WNOHANG) != -1) {
             sleep(1);
-            double mem = get_memory_usage(pid);
-            if (limit && mem > limit) {
-                cerr << "Daemon process uses " << mem << " MB of memory which is larger than " << limit << " MB. Killing...\n";
+            if (!limit) continue;
+            bool exceeded = false;
+            vector<pid_t> workers;
+            for (auto& usage: get_memory_usage(pid)) {
+                if (usage.second <= limit) continue;
+                cerr << (usage.first == pid? string("Daemon") : "Worker " + lexical_cast<string>(usage.first))
+                    << " process uses " << usage.second << " MB of memory which is larger than " << limit << " MB. Killing...\n";
+                if (usage.first == pid) {
+                    exceeded = true;
+                } else {
+                    workers.push_back(usage.first);
+                }
+            }
+            if (exceeded) {
                 graceful_kill(pid);
                 break;
             }
+            for (pid_t worker: workers) kill(worker, SIGKILL);
         }
     }
 };
 
+thread_local struct ev_loop* Tools::loop = NULL;
+
 }
 #endif
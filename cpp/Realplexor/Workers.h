@@ -0,0 +1,498 @@
+//@
+//@ Dklab Realplexor: Comet server which handles 1000000+ parallel browser connections
+//@ Author: Dmitry Koterov, dkLab (C)
+//@ License: GPL 2.0
+//@
+//@ 2025-* Contributor: Alexxiy
+//@ GitHub: http://github.com/alexxiy/
+//@
+//@ ATTENTION: Java-style C++ programming below. :-)
+//@
+//@ This is a line-by-line C++ rewrite of Perl prototype code with obvious speed
+//@ optimizations (like avoiding excess copies, config pre-parsing etc.).
+//@
+//@ The code is so compact (2600 lines) and so simple, that I decided not to
+//@ split it into *.hpp & *.cpp files nor create Makefiles, but place
+//@ everything into included *.h files (like Perl, Java, C# and most of other
+//@ languages do). It is not quite common for C++, but it surely simple
+//@ when a program is small (especially when it is rewritten line by line
+//@ from another language).
+//@
+//@ Also the code has global variables within the top namespace: one variable
+//@ per Storage and one CONFIG, they are like singletons.
+//@
+
+//
+// Realplexor::Workers: additional WAIT worker processes.
+//
+// If WAIT_WORKERS > 1, the main process forks WAIT_WORKERS - 1 workers.
+// Each process listens WAIT_ADDR with SO_REUSEPORT (so the kernel spreads
+// WAIT connections among processes) and has its own Storages, i.e. it
+// serves its own clients only. IN line is served by the main process:
+// each received data block is broadcast to all workers, so every worker
+// delivers it to its own clients. Workers report changes of per-ID
+// connection counters back, so the main process keeps online status
+// and events of all clients for ONLINE and WATCH commands.
+//
+// Workers are forked by a spawner process, which is forked by the main
+// process before anything else is started (it has no threads, servers
+// and data). When a worker dies (or is killed because it lags), only
+// this worker is restarted; the main process and other workers keep
+// running with their clients and Storages.
+//
+// Messages between processes are: [u32 length][u8 type][payload].
+//
+
+#ifndef REALPLEXOR_WORKERS_H
+#define REALPLEXOR_WORKERS_H
+
+namespace Realplexor {
+using std::shared_ptr;
+
+class Workers
+{
+    // Message types.
+    enum MessageType {
+        DATA = 'D',     // main -> worker: data block for IDs
+        COUNTERS = 'C', // worker -> main: changes of connection counters
+    };
+
+    // Delay (seconds) before a terminated worker is restarted.
+    static constexpr double RESTART_DELAY = 1;
+
+    // Socket pair end connected to another process. The main process
+    // keeps a channel per worker number while the worker is restarted.
+    struct Channel
+    {
+        int num;
+        pid_t pid;
+        fh_t fh; // NULL while the worker is restarted
+        string rdata;
+        ev::io watcher;
+        ev::timer restarter;
+        Workers* workers;
+        bool killed; // the worker lags and is killed
+
+        // Main process: number of connections to each ID in the worker.
+        unordered_map<ident_t, int> fhs;
+
+        void handle(ev::io& w, int revents)
+        {
+            workers->_on_read(this);
+        }
+
+        void restart(ev::timer& w, int revents)
+        {
+            workers->_start_worker(this);
+        }
+    };
+
+    // Worker number: 0 for the main process.
+    int num;
+    vector<shared_ptr<Channel>> channels;
+
+    // Main process: socket connected to the spawner process.
+    int spawner;
+
+    // Main process: number of connections to each ID in all workers.
+    unordered_map<ident_t, int> remote_fhs;
+
+    // Worker: connection counter changes not reported yet; they are
+    // reported once per event loop iteration.
+    unordered_map<ident_t, int> counters;
+    ev::prepare flusher;
+
+public:
+
+    Workers(): num(0), spawner(-1) {}
+
+    // Forks count - 1 workers. Returns the number of the worker which
+    // continues execution (0 for the main process).
+    int spawn(int count)
+    {
+        if (count < 2) return num;
+        int sv[2];
+        _socketpair(sv);
+        pid_t main_pid = getpid();
+        pid_t pid = fork();
+        if (pid < 0) die("ERROR calling fork(): $!");
+        if (!pid) {
+            // Spawner dies together with the main process.
+            prctl(PR_SET_PDEATHSIG, SIGKILL);
+            if (getppid() != main_pid) exit(0);
+            ::close(sv[0]);
+            return _run_spawner(sv[1]);
+        }
+        ::close(sv[1]);
+        spawner = sv[0];
+        for (int n = 1; n < count; n++) {
+            _start_worker(_new_channel(n).get());
+        }
+        return num;
+    }
+
+    // Returns true in worker processes.
+    bool is_worker()
+    {
+        return num > 0;
+    }
+
+    // Sends a signal to all workers.
+    void kill(int sig)
+    {
+        if (is_worker()) return;
+        for (auto& channel: channels) {
+            if (channel->fh) ::kill(channel->pid, sig);
+        }
+    }
+
+    // Passes a data block added to IDs to all workers. The data itself
+    // is not copied: it is written from the same buffer to each worker.
+    void broadcast_data(const DataPairChain& pairs, const LimitIdsRef& limit_ids, const DataRef& rdata)
+    {
+        if (is_worker() || channels.empty() || pairs.empty()) return;
+        string head;
+        _put_u32(head, pairs.size());
+        for (auto& pair: pairs) {
+            _put_u64(head, pair.cursor);
+            _put_str(head, pair.id.str());
+        }
+        _put_u32(head, limit_ids->size());
+        for (auto& id: *limit_ids) {
+            _put_str(head, id.str());
+        }
+        _put_u32(head, rdata->length());
+        OutChunkChain out = {
+            _header(DATA, head.length() + rdata->length()),
+            make_local<RefString>(std::move(head)),
+            rdata
+        };
+        size_t length = out[0]->length() + out[1]->length() + rdata->length();
+        for (auto& channel: channels) {
+            if (!channel->fh || channel->killed) continue;
+            // A stalled worker would make this process buffer all data
+            // without bound: kill it, it is restarted when the channel
+            // is closed (see _on_read()).
+            size_t buffered = channel->fh->get_buffered();
+            if (CONFIG.worker_outbuf_maxlen && buffered + length > CONFIG.worker_outbuf_maxlen) {
+                LOGGER("Worker " + lexical_cast<string>(channel->pid) + " does not read data (" + lexical_cast<string>(buffered) + " bytes buffered), killing it");
+                ::kill(channel->pid, SIGKILL);
+                channel->killed = true;
+                continue;
+            }
+            channel->fh->sendv(out);
+        }
+    }
+
+    // Called when a client starts listening an ID.
+    void id_connected(const ident_t& id)
+    {
+        if (is_worker()) {
+            counters[id]++;
+        } else {
+            Common::set_id_online(id);
+        }
+    }
+
+    // Called when a client stops listening an ID.
+    void id_disconnected(const ident_t& id)
+    {
+        if (is_worker()) {
+            counters[id]--;
+        } else if (!get_num_fhs_by_id(id)) {
+            online_timers.start_timer_by_id(id, CONFIG.offline_timeout);
+        }
+    }
+
+    // Returns the number of connections listening an ID in all processes
+    // (meaningful in the main process only).
+    int get_num_fhs_by_id(const ident_t& id)
+    {
+        auto it = remote_fhs.find(id);
+        return connected_fhs.get_num_fhs_by_id(id) + (it != remote_fhs.end()? it->second : 0);
+    }
+
+private:
+
+    // Spawner: forks a worker on each request of the main process and
+    // passes back its pid and the main process end of its channel.
+    // Returns only within a forked worker.
+    int _run_spawner(int sock)
+    {
+        pid_t spawner_pid = getpid();
+        int n;
+        while (::read(sock, &n, sizeof(n)) == sizeof(n)) {
+            int sv[2];
+            _socketpair(sv);
+            pid_t pid = fork();
+            if (pid < 0) die("ERROR calling fork(): $!");
+            if (!pid) {
+                // Worker dies together with the spawner.
+                prctl(PR_SET_PDEATHSIG, SIGKILL);
+                if (getppid() != spawner_pid) exit(0);
+                ::close(sock);
+                ::close(sv[0]);
+                // The main process may have reloaded the config since
+                // the spawner is started.
+                CONFIG.reload(ARGV.size()? ARGV[0] : "", true);
+                ev_loop_fork(EV_DEFAULT);
+                num = n;
+                _open_channel(_new_channel(0).get(), sv[1]);
+                flusher.set<Workers, &Workers::_flush_counters>(this);
+                flusher.start();
+                return num;
+            }
+            ::close(sv[1]);
+            _send_fd(sock, pid, sv[0]);
+            ::close(sv[0]);
+        }
+        // The main process is terminated.
+        exit(0);
+    }
+
+    // Main process: asks the spawner to fork a worker for the channel.
+    void _start_worker(Channel* channel)
+    {
+        int n = channel->num;
+        if (::send(spawner, &n, sizeof(n), MSG_NOSIGNAL) != sizeof(n)) {
+            die("ERROR calling send(): $!");
+        }
+        _open_channel(channel, _recv_fd(spawner, channel->pid));
+    }
+
+    // Main process: forgets clients of a terminated worker and restarts
+    // it a bit later. Other processes are not touched.
+    void _restart_worker(Channel* channel)
+    {
+        LOGGER("Worker " + lexical_cast<string>(channel->pid) + " is terminated, restarting it");
+        channel->watcher.stop();
+        channel->fh->shutdown(2);
+        channel->fh.reset();
+        channel->rdata.clear();
+        channel->killed = false;
+        auto fhs = std::move(channel->fhs);
+        for (auto& pair: fhs) {
+            _add_remote_fhs(channel, pair.first, -pair.second);
+        }
+        channel->restarter.start(RESTART_DELAY, 0);
+    }
+
+    shared_ptr<Channel> _new_channel(int n)
+    {
+        shared_ptr<Channel> channel(new Channel());
+        channel->num = n;
+        channel->pid = 0;
+        channel->workers = this;
+        channel->killed = false;
+        channel->watcher.set<Channel, &Channel::handle>(channel.get());
+        channel->restarter.set<Channel, &Channel::restart>(channel.get());
+        channels.push_back(channel);
+        return channel;
+    }
+
+    void _open_channel(Channel* channel, int fd)
+    {
+        channel->fh.reset(new Realplexor::Event::FH(shared_ptr<Socket>(new Socket(fd, "pipe")), 0, false));
+        channel->watcher.set(fd, EV_READ);
+        channel->watcher.start();
+    }
+
+    static void _socketpair(int sv[2])
+    {
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+            die("ERROR calling socketpair(): $!");
+        }
+    }
+
+    // Passes a pid and a descriptor via a unix socket.
+    static void _send_fd(int sock, pid_t pid, int fd)
+    {
+        char control[CMSG_SPACE(sizeof(fd))];
+        memset(control, 0, sizeof(control));
+        struct iovec iov = { &pid, sizeof(pid) };
+        struct msghdr msg = {};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(fd));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(fd));
+        if (sendmsg(sock, &msg, MSG_NOSIGNAL) < 0) {
+            die("ERROR calling sendmsg(): $!");
+        }
+    }
+
+    // Receives a pid and a descriptor passed by _send_fd().
+    static int _recv_fd(int sock, pid_t& pid)
+    {
+        int fd;
+        char control[CMSG_SPACE(sizeof(fd))];
+        struct iovec iov = { &pid, sizeof(pid) };
+        struct msghdr msg = {};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        ssize_t n;
+        while ((n = recvmsg(sock, &msg, 0)) < 0 && errno == EINTR);
+        struct cmsghdr* cmsg = n == sizeof(pid)? CMSG_FIRSTHDR(&msg) : NULL;
+        if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS) {
+            die("ERROR receiving a worker from the spawner: $!");
+        }
+        memcpy(&fd, CMSG_DATA(cmsg), sizeof(fd));
+        return fd;
+    }
+
+    // Reads and processes all complete messages from a channel.
+    void _on_read(Channel* channel)
+    {
+        size_t nread = 0;
+        try {
+            nread = channel->fh->recv_and_append_to(channel->rdata);
+        } catch (std::exception& e) {
+            // Connection is reset (e.g. a lagging worker is killed).
+        }
+        if (!nread) {
+            if (is_worker()) {
+                LOGGER("Main process is terminated, exiting");
+                exit(0);
+            }
+            _restart_worker(channel);
+            return;
+        }
+        string& rdata = channel->rdata;
+        size_t pos = 0;
+        while (rdata.length() - pos >= 5) {
+            const char* p = rdata.data() + pos;
+            size_t len = _get_u32(p);
+            if (rdata.length() - pos - 5 < len) break;
+            char type = *p++;
+            if (type == DATA) {
+                _process_data(p);
+            } else if (type == COUNTERS) {
+                _process_counters(channel, p, p + len);
+            }
+            pos += 5 + len;
+        }
+        rdata.erase(0, pos);
+    }
+
+    // Worker: adds a data block received from the main process.
+    void _process_data(const char* p)
+    {
+        DataPairChain pairs(_get_u32(p));
+        for (auto& pair: pairs) {
+            pair.cursor = _get_u64(p);
+            pair.id = _get_id(p);
+        }
+        LimitIdsRef limit_ids = make_local<RefLimitIdsSet>();
+        for (size_t n = _get_u32(p); n > 0; n--) {
+            limit_ids->insert(_get_id(p));
+        }
+        size_t len = _get_u32(p);
+        DataRef rdata = make_local<RefString>(p, len);
+        std::vector<ident_t> ids_to_process;
+        for (auto& pair: pairs) {
+            Common::push_data_to_id(pair.id, pair.cursor, rdata, limit_ids);
+            ids_to_process.push_back(pair.id);
+        }
+        Common::send_pendings_later(ids_to_process);
+    }
+
+    // Main process: applies connection counter changes of a worker.
+    void _process_counters(Channel* channel, const char* p, const char* end)
+    {
+        while (p < end) {
+            int delta = (int)_get_u32(p);
+            ident_t id = _get_id(p);
+            _add_remote_fhs(channel, id, delta);
+        }
+    }
+
+    // Main process: changes the number of a worker's connections to ID.
+    void _add_remote_fhs(Channel* channel, const ident_t& id, int delta)
+    {
+        int& worker_fhs = channel->fhs[id];
+        worker_fhs += delta;
+        if (worker_fhs <= 0) channel->fhs.erase(id);
+        int& num_fhs = remote_fhs[id];
+        num_fhs += delta;
+        if (num_fhs <= 0) remote_fhs.erase(id);
+        if (delta > 0) {
+            Common::set_id_online(id);
+        } else if (delta < 0 && !get_num_fhs_by_id(id)) {
+            online_timers.start_timer_by_id(id, CONFIG.offline_timeout);
+        }
+    }
+
+    // Worker: reports accumulated connection counter changes.
+    void _flush_counters(ev::prepare& w, int revents)
+    {
+        string msg;
+        for (auto& counter: counters) {
+            if (!counter.second) continue;
+            _put_u32(msg, (uint32_t)counter.second);
+            _put_str(msg, counter.first.str());
+        }
+        counters.clear();
+        if (!msg.length()) return;
+        channels[0]->fh->sendv({ _header(COUNTERS, msg.length()), make_local<RefString>(std::move(msg)) });
+    }
+
+    static local_ptr<const RefString> _header(MessageType type, size_t len)
+    {
+        string s;
+        _put_u32(s, len);
+        s += (char)type;
+        return make_local<RefString>(std::move(s));
+    }
+
+    static void _put_u32(string& s, uint32_t v)
+    {
+        s.append((const char*)&v, sizeof(v));
+    }
+
+    static void _put_u64(string& s, uint64_t v)
+    {
+        s.append((const char*)&v, sizeof(v));
+    }
+
+    static void _put_str(string& s, const string& v)
+    {
+        _put_u32(s, v.length());
+        s += v;
+    }
+
+    static uint32_t _get_u32(const char*& p)
+    {
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+        p += sizeof(v);
+        return v;
+    }
+
+    static uint64_t _get_u64(const char*& p)
+    {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        p += sizeof(v);
+        return v;
+    }
+
+    static ident_t _get_id(const char*& p)
+    {
+        size_t len = _get_u32(p);
+        ident_t v(p, p + len);
+        p += len;
+        return v;
+    }
+};
+
+}
+
+Realplexor::Workers workers;
+
+#endif
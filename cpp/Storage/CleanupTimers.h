@@ -33,46 +33,18 @@
 #define REALPLEXOR_STORAGE_CLEANUPTIMERS_H
 
 namespace Storage {
-using std::shared_ptr;
 
-class CleanupTimers
+class CleanupTimers: public IdTimers
 {
-    map<ident_t, shared_ptr<Realplexor::Event::ITimer>> storage;
-
 public:
 
     CleanupTimers() {}
 
-    template<typename Cb>
-    void start_timer_for_id(ident_t id, int timeout, Cb callback)
-    {
-        // Remove current timer if present.
-        if (storage.count(id)) {
-            storage[id]->remove();
-            storage.erase(id);
-        }
-        // Create new timer.
-        auto wrapper = [this, callback, id](int) {
-            auto guard = this->storage[id];
-            this->storage.erase(id); // thanks to guard, the timer is deleted only when we exit this closure
-            callback(); // it is important for logs to call erase() before the callback
-        };
-        storage[id].reset(new Realplexor::Event::Timer<decltype(wrapper)>(wrapper));
-        storage[id]->start(timeout);
-    }
-
-    int get_num_items()
-    {
-        return storage.size();
-    }
-
-    string get_stats()
+    void start_timer_for_id(const ident_t& id, int timeout, handler_t handler)
     {
-        vector<string> result;
-        for (auto &item: storage) {
-            result.push_back(item.first + " => assigned\n");
-        }
-        return join(result, "");
+        Timer& timer = storage[id];
+        timer.handler = handler;
+        _start(timer, id, timeout);
     }
 
 };
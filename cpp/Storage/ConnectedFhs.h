@@ -40,31 +40,33 @@ using std::shared_ptr;
 
 class ConnectedFhs
 {
-    map<ident_t, DataCursorFhByFh> storage;
+    flat_map<ident_t, DataCursorFhByFh> storage;
 
 public:
 
     ConnectedFhs() {}
 
-    void add_to_id(const ident_t& id, cursor_t cursor, fh_t fh)
+    void add_to_id(const ident_t& id, cursor_t cursor, const fh_t& fh)
     {
         DataCursorFh &e = storage[id][fh.get()];
         e.cursor = cursor;
         e.fh = fh;
     }
 
-    void del_from_id_by_fh(const ident_t& id, fh_t fh)
+    void del_from_id_by_fh(const ident_t& id, const fh_t& fh)
     {
-        if (storage.count(id)) {
-            storage[id].erase(fh.get());
-            if (!storage[id].size()) storage.erase(id);
+        auto it = storage.find(id);
+        if (it != storage.end()) {
+            it->second.erase(fh.get());
+            if (!it->second.size()) storage.erase(it);
         }
     }
 
     const DataCursorFhByFh& get_hash_by_id(const ident_t& id)
     {
         static DataCursorFhByFh empty;
-        return storage.count(id)? storage[id] : empty;
+        auto it = storage.find(id);
+        return it != storage.end()? it->second : empty;
     }
 
     int get_num_items()
@@ -74,19 +76,21 @@ public:
 
     int get_num_fhs_by_id(const ident_t& id)
     {
-        return storage.count(id)? storage[id].size() : 0;
+        auto it = storage.find(id);
+        return it != storage.end()? it->second.size() : 0;
     }
 
     std::string get_stats()
     {
         std::vector<std::string> result;
-        for (auto& pairs: storage) {
-            auto transformed = map_to_vector(pairs.second, [](const DataCursorFhByFh::value_type& e) {
-                return "(" + lexical_cast<std::string>(e.second.fh) + ")";
+        for (auto& id: sort_keys(storage)) {
+            const DataCursorFhByFh& fhs = storage[id];
+            auto transformed = map_to_vector(sort_keys(fhs), [&fhs](void* fh) {
+                return "(" + lexical_cast<std::string>(fhs.find(fh)->second.fh) + ")";
             });
 
             result.push_back(
-                std::string(pairs.first) + " => " +
+                id.str() + " => " +
                 join(transformed, ", ") +
                 "\n"
             );
@@ -38,6 +38,9 @@
 // only those who also listens IDs from %limit_ids keys. This is used
 // to control data visibility.
 //
+// In C++ each queue is a ring of at most MAX_DATA_FOR_ID items sorted
+// by cursor (the oldest first), so it does not allocate once filled.
+//
 
 #ifndef REALPLEXOR_STORAGE_DATATOSEND_H
 #define REALPLEXOR_STORAGE_DATATOSEND_H
@@ -48,7 +51,7 @@ using std::shared_ptr;
 
 class DataToSend
 {
-    map<ident_t, DataChunkChain> storage;
+    flat_map<ident_t, DataChunkChain> storage;
 
 public:
 
@@ -59,23 +62,51 @@ public:
         storage.erase(id);
     }
 
-    void add_dataref_to_id(const ident_t& id, cursor_t cursor, shared_ptr<string> rdata, shared_ptr<unordered_set<ident_t>> rlimit_ids)
+    // Adds data to the ID queue keeping at most max_num items: when the
+    // queue is full, the oldest item (maybe the new one) is dropped.
+    void add_dataref_to_id(const ident_t& id, cursor_t cursor, const DataRef& rdata, const LimitIdsRef& rlimit_ids, size_t max_num)
     {
-        auto& list = storage[id];
-        // In most cases new cursor is greater than the first array
-        // element, so we may unshif it without re-sorting to speedup.
-        DataChunkChain newList;
-        newList.push_back(DataChunk(cursor, rdata, rlimit_ids));
-        list.merge(newList, [](const DataChunk& e1, const DataChunk& e2) { return e2.cursor <= e1.cursor; });
-        // "<=" is significant here, because we need to insert new element at the head
-        // of the list if it is less than all other elements (or - if not at the head -
-        // then "as left as it could be done").
+        if (!max_num) return;
+        auto& queue = storage[id];
+        // In most cases new cursor is greater than the last one, so
+        // we may append it without searching. For equal cursors the
+        // new item is placed after existing ones ("as new as it could be").
+        size_t pos = queue.size();
+        if (pos && cursor < queue.back().cursor) pos = first_newer(queue, cursor);
+        // The ring grows up to max_num items and then never allocates.
+        if (queue.capacity() > max_num || (queue.full() && queue.capacity() < max_num)) {
+            size_t size = queue.size();
+            queue.reserve(std::min(max_num, std::max<size_t>(4, queue.capacity() * 2)));
+            size_t dropped = size - queue.size();
+            pos = pos > dropped? pos - dropped : 0;
+        }
+        if (queue.full()) {
+            if (!pos) return;
+            queue.pop_front();
+            pos--;
+        }
+        // Limiters are matched by keys (see Common::send_pendings()).
+        if (rlimit_ids->keys.size() != rlimit_ids->size()) rlimit_ids->index();
+        queue.insert(pos, DataChunk(cursor, rdata, rlimit_ids));
+    }
+
+    // Returns the index of the first item with cursor greater than
+    // the specified one (or the queue size if there is no such item).
+    static size_t first_newer(const DataChunkChain& queue, cursor_t cursor)
+    {
+        size_t lo = 0, hi = queue.size();
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (queue[mid].cursor <= cursor) lo = mid + 1; else hi = mid;
+        }
+        return lo;
     }
 
     const DataChunkChain& get_data_by_id(const ident_t& id)
     {
         static DataChunkChain empty;
-        return storage.count(id)? storage[id] : empty;
+        auto it = storage.find(id);
+        return it != storage.end()? it->second : empty;
     }
 
     int get_num_items()
@@ -85,28 +116,28 @@ public:
 
     void clean_old_data_for_id(const ident_t& id, size_t max_num)
     {
-        if (!storage.count(id) || storage[id].size() < max_num) return;
-        auto& list = storage[id];
-        while (list.size() > max_num) {
-            list.pop_back();
-        }
+        auto it = storage.find(id);
+        if (it == storage.end() || it->second.capacity() <= max_num) return;
+        it->second.reserve(max_num); // MAX_DATA_FOR_ID is decreased by reload
+
     }
 
     string get_stats()
     {
         vector<string> result;
-        for (auto& idlist: storage) { // sorted
-            const ident_t& id = idlist.first;
+        for (auto& id: sort_keys(storage)) {
             vector<string> pairs;
-            for (auto& elt: idlist.second) {
+            const DataChunkChain& queue = storage[id];
+            for (size_t i = queue.size(); i > 0; i--) {
+                const DataChunk& elt = queue[i - 1];
                 pairs.push_back(
                     "[" + lexical_cast<std::string>(elt.cursor) + ": " +
                     lexical_cast<string>(elt.rdata->length()) + "b" +
-                    (elt.rlimit_ids->size()? ", limited by (" + join(sort_keys(*elt.rlimit_ids), ", ") + ")" : "") +
+                    (elt.rlimit_ids->size()? ", limited by (" + join(interned_strs(sort_keys(*elt.rlimit_ids)), ", ") + ")" : "") +
                     "]"
                 );
             }
-            result.push_back(id + " => " + join(pairs, ", ") + "\n");
+            result.push_back(id.str() + " => " + join(pairs, ", ") + "\n");
         }
         return join(result, "");
     }
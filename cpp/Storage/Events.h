@@ -59,14 +59,15 @@ public:
     {
         // Initial request. Return fake event with its cursor.
         if (!from_cursor) {
-            events.push_back(DataEvent(cur_pos, FAKE, "FAKE"));
+            static const ident_t fake("FAKE");
+            events.push_back(DataEvent(cur_pos, FAKE, fake));
             return;
         }
         unordered_set<ident_t> seen;
         // Iterate most recent events first.
         for (auto& ev: chain) {
             if (ev.cursor <= from_cursor) break;
-            if (!seen.count(ev.id) && checker->matched(ev.id)) {
+            if (!seen.count(ev.id) && checker->matched(ev.id.str())) {
                 events.push_front(ev);
                 seen.insert(ev.id);
             }
@@ -0,0 +1,110 @@
+//@
+//@ Dklab Realplexor: Comet server which handles 1000000+ parallel browser connections
+//@ Author: Dmitry Koterov, dkLab (C)
+//@ License: GPL 2.0
+//@
+//@ 2025-* Contributor: Alexxiy
+//@ GitHub: http://github.com/alexxiy/
+//@
+//@ ATTENTION: Java-style C++ programming below. :-)
+//@
+//@ This is a line-by-line C++ rewrite of Perl prototype code with obvious speed
+//@ optimizations (like avoiding excess copies, config pre-parsing etc.).
+//@
+//@ The code is so compact (2600 lines) and so simple, that I decided not to
+//@ split it into *.hpp & *.cpp files nor create Makefiles, but place
+//@ everything into included *.h files (like Perl, Java, C# and most of other
+//@ languages do). It is not quite common for C++, but it surely simple
+//@ when a program is small (especially when it is rewritten line by line
+//@ from another language).
+//@
+//@ Also the code has global variables within the top namespace: one variable
+//@ per Storage and one CONFIG, they are like singletons.
+//@
+
+//
+// Storage::IdTimers: base class for storages with a timer for each ID.
+//
+// Structure: { ID => [handler, timeout, expires] }
+// Timers of all such storages are expired by one shared TimerWheel:
+// a timer is just an expiry tick, so (re)starting it is a field update.
+// When the timer expires, the ID is removed and its handler is called.
+//
+
+#ifndef REALPLEXOR_STORAGE_IDTIMERS_H
+#define REALPLEXOR_STORAGE_IDTIMERS_H
+
+namespace Storage {
+using Realplexor::Event::TimerWheel;
+
+class IdTimers: public TimerWheel::IClient
+{
+public:
+    typedef void (*handler_t)(const ident_t& id, int timeout);
+
+protected:
+    struct Timer
+    {
+        handler_t handler = NULL;
+        int timeout = 0;
+        TimerWheel::tick_t expires = 0;   // 0 if the timer is stopped
+        TimerWheel::tick_t scheduled = 0; // when on_tick() is called for the ID (0 if never)
+    };
+
+    flat_map<ident_t, Timer> storage;
+
+    static TimerWheel& _wheel()
+    {
+        static TimerWheel wheel;
+        return wheel;
+    }
+
+    void _start(Timer& timer, const ident_t& id, int timeout)
+    {
+        timer.timeout = timeout;
+        timer.expires = _wheel().tick_after(timeout);
+        // If the ID is already scheduled earlier, it is rescheduled
+        // at that time (see on_tick()).
+        if (!timer.scheduled || timer.expires < timer.scheduled) {
+            timer.scheduled = _wheel().schedule(this, id, timer.expires);
+        }
+    }
+
+public:
+
+    void on_tick(const ident_t& id, TimerWheel::tick_t tick)
+    {
+        auto it = storage.find(id);
+        // The ID is removed or rescheduled since then.
+        if (it == storage.end() || it->second.scheduled != tick) return;
+        Timer& timer = it->second;
+        if (!timer.expires) {
+            timer.scheduled = 0;
+        } else if (timer.expires > tick) {
+            timer.scheduled = _wheel().schedule(this, id, timer.expires);
+        } else {
+            handler_t handler = timer.handler;
+            int timeout = timer.timeout;
+            storage.erase(it); // it is important for logs to erase before the handler call
+            handler(id, timeout);
+        }
+    }
+
+    int get_num_items()
+    {
+        return storage.size();
+    }
+
+    string get_stats()
+    {
+        vector<string> result;
+        for (auto& id: sort_keys(storage)) {
+            result.push_back(id.str() + " => assigned\n");
+        }
+        return join(result, "");
+    }
+};
+
+}
+
+#endif
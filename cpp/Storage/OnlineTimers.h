@@ -37,65 +37,39 @@
 #define REALPLEXOR_STORAGE_ONLINETIMERS_H
 
 namespace Storage {
-using std::shared_ptr;
 
-class OnlineTimers
+class OnlineTimers: public IdTimers
 {
-    map<ident_t, shared_ptr<Realplexor::Event::ITimer>> storage;
-
 public:
 
     OnlineTimers() {}
 
     // Return true if we just assigned this timer, false if it was
     // already assigned.
-    template<typename Cb>
-    bool assign_stopped_timer_for_id(const ident_t& id, Cb callback)
+    bool assign_stopped_timer_for_id(const ident_t& id, handler_t handler)
     {
-        bool firstTime = true;
-        // Remove current timer if present.
-        if (storage.count(id)) {
-            storage[id]->remove();
-            storage.erase(id);
-            firstTime = false;
-        }
-        // Create new stopped timer.
-        auto wrapper = [this, callback, id](int) {
-            auto guard = this->storage[id];
-            this->storage.erase(id); // thanks to guard, the timer is deleted only when we exit this closure
-            callback(); // it is important for logs to call erase() before the callback
-        };
-        storage[id].reset(new Realplexor::Event::Timer<decltype(wrapper)>(wrapper));
-        return firstTime;
+        size_t size = storage.size();
+        Timer& timer = storage[id];
+        timer.handler = handler;
+        timer.expires = 0;
+        return storage.size() > size;
     }
 
     void start_timer_by_id(const ident_t& id, int timeout)
     {
-        if (storage.count(id)) {
-            storage[id]->remove(); // needed to avoid multiple addition of the same timer
-            storage[id]->start(timeout);
+        auto it = storage.find(id);
+        if (it != storage.end()) {
+            _start(it->second, id, timeout);
         }
     }
 
-    int get_num_items()
-    {
-        return storage.size();
-    }
-
+    // Returns matched IDs sorted by name.
     void get_ids_ref(shared_ptr<prefix_checker> checker, vector<ident_t>& result)
     {
         for (auto& pair: storage) {
-            if (checker->matched(pair.first)) result.push_back(pair.first);
-        }
-    }
-
-    string get_stats()
-    {
-        vector<string> result;
-        for (auto& item: storage) {
-            result.push_back(item.first + " => assigned\n");
+            if (checker->matched(pair.first.str())) result.push_back(pair.first);
         }
-        return join(result, "");
+        sort(result.begin(), result.end());
     }
 
 };
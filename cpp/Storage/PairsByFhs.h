@@ -28,6 +28,7 @@
 // Structure: { FH => [ [cursor1, id1], [cursor2, id2], ...] }
 // Which IDs are registered in which FHs. This information is used to
 // implement listening on multiple IDs during a single connection.
+// Keys of these IDs are also kept sorted to check data limiters.
 //
 
 #ifndef REALPLEXOR_PAIRSBYFHS_H
@@ -39,26 +40,47 @@ using std::shared_ptr;
 
 class PairsByFhs
 {
-    map<void*, shared_ptr<DataPairChain>> storage;
+    struct Entry
+    {
+        shared_ptr<DataPairChain> pairs;
+        IdKeyChain keys;
+    };
+
+    flat_map<void*, Entry> storage;
 
 public:
 
     PairsByFhs() {}
 
-    void set_pairs_for_fh(fh_t fh, shared_ptr<DataPairChain> list)
+    void set_pairs_for_fh(const fh_t& fh, shared_ptr<DataPairChain> list)
     {
-        storage[fh.get()] = list;
+        Entry& entry = storage[fh.get()];
+        entry.keys.clear();
+        entry.keys.reserve(list->size());
+        for (auto& pair: *list) entry.keys.push_back(pair.id.key());
+        std::sort(entry.keys.begin(), entry.keys.end());
+        entry.keys.erase(std::unique(entry.keys.begin(), entry.keys.end()), entry.keys.end());
+        entry.pairs = list;
     }
 
-    void remove_by_fh(fh_t fh)
+    void remove_by_fh(const fh_t& fh)
     {
         storage.erase(fh.get());
     }
 
-    const DataPairChain& get_pairs_by_fh(fh_t fh)
+    const DataPairChain& get_pairs_by_fh(const fh_t& fh)
     {
         static DataPairChain empty;
-        return storage.count(fh.get())? *storage[fh.get()] : empty;
+        auto it = storage.find(fh.get());
+        return it != storage.end()? *it->second.pairs : empty;
+    }
+
+    // Returns sorted keys of IDs listened by the FH.
+    const IdKeyChain& get_keys_by_fh(const fh_t& fh)
+    {
+        static IdKeyChain empty;
+        auto it = storage.find(fh.get());
+        return it != storage.end()? it->second.keys : empty;
     }
 
     int get_num_items()
@@ -69,13 +91,13 @@ public:
     std::string get_stats()
     {
         std::vector<std::string> result;
-        for (auto& pairs: storage) {
-            auto transformed = map_to_vector(*pairs.second, [](const DataPair& e) -> std::string {
-                return lexical_cast<std::string>(e.cursor) + ":" + e.id;
+        for (auto& fh: sort_keys(storage)) {
+            auto transformed = map_to_vector(*storage[fh].pairs, [](const DataPair& e) -> std::string {
+                return lexical_cast<std::string>(e.cursor) + ":" + e.id.str();
             });
 
             result.push_back(
-                "(" + lexical_cast<std::string>(pairs.first) + ") => " +
+                "(" + lexical_cast<std::string>(fh) + ") => " +
                 join(transformed, ", ") +
                 "\n"
             );
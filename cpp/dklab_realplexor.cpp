@@ -24,7 +24,10 @@
 
 #include <vector>
 #include <list>
+#include <deque>
 #include <unordered_set>
+#include <unordered_map>
+#include <string_view>
 #include <string>
 #include <stdarg.h>
 #include <stdexcept>
@@ -35,7 +38,12 @@
 #include <set>
 #include <exception>
 #include <algorithm>
+#include <cmath>
 #include <functional>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include <boost/algorithm/string.hpp>
 #include <boost/algorithm/string/regex.hpp>
 #include <boost/filesystem/path.hpp>
@@ -47,13 +55,19 @@
 
 #include <signal.h>
 #include <unistd.h>
+#include <crypt.h>
 #include <pwd.h>
 #include <string.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/resource.h>
 #include <sys/wait.h>
+#include <sys/prctl.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/un.h>
+#include <sys/stat.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <fcntl.h>
@@ -70,7 +84,15 @@ using std::exception;
 #include "utils/misc.h"
 #include "utils/checked_map.h"
 #include "utils/prefix_checker.h"
+#include "utils/interned_string.h"
+#include "utils/flat_map.h"
+#include "utils/ring.h"
+#include "utils/slab.h"
+#include "utils/local_ptr.h"
+#include "utils/arena.h"
 #include "utils/stdmiss.h"
+#include "utils/mpsc_ring.h"
+#include "utils/thread_pool.h"
 #include "utils/Socket.h"
 #include "utils/ev++0x.h"
 
@@ -79,17 +101,23 @@ using std::exception;
 #include "Realplexor/Tools.h"
 #include "Realplexor/Event/FH.h"
 #include "Realplexor/Event/Server.h"
-#include "Realplexor/Event/Timer.h"
+#include "Realplexor/Event/TimerWheel.h"
 #include "Realplexor/Event/Signal.h"
+#include "Realplexor/Event/Queue.h"
+#include "Realplexor/Event/LoopLag.h"
 #include "Realplexor/Event/Connection.h"
 #include "Storage/ConnectedFhs.h"
+#include "Storage/IdTimers.h"
 #include "Storage/CleanupTimers.h"
 #include "Storage/OnlineTimers.h"
 #include "Storage/Events.h"
 #include "Storage/DataToSend.h"
 #include "Storage/PairsByFhs.h"
 #include "Realplexor/Common.h"
+#include "Realplexor/RequestParser.h"
+#include "Realplexor/Workers.h"
 #include "Connection/In.h"
+#include "Connection/InBinary.h"
 #include "Connection/Wait.h"
 
 
@@ -102,23 +130,56 @@ void mainloop()
     string additional_conf = ARGV.size()? ARGV[0] : "";
     CONFIG.load(additional_conf);
 
+    // Start additional WAIT workers: each of them continues from here
+    // with its own WAIT server and Storages.
+    int worker = workers.spawn(CONFIG.wait_workers);
+
     // Initialize servers.
     Realplexor::Event::Server<Connection::Wait> wait(
-        "WAIT", // name
+        worker? "WAIT/" + lexical_cast<string>(worker) : "WAIT", // name
         CONFIG.wait_addr, // listen
         CONFIG.wait_timeout, // timeout
-        &Realplexor::Common::logger
+        &Realplexor::Common::logger,
+        CONFIG.wait_workers > 1 // reuse_port
     );
-    Realplexor::Event::Server<Connection::In> in(
+    std::shared_ptr<Realplexor::Event::Server<Connection::In>> in;
+    struct ev_loop* in_loop = CONFIG.in_thread? ev_loop_new(EVFLAG_AUTO) : EV_DEFAULT;
+    if (!worker) in.reset(new Realplexor::Event::Server<Connection::In>(
         "IN", // name
         CONFIG.in_addr, // listen
         CONFIG.in_timeout, // timeout
-        &Realplexor::Common::logger
-    );
+        &Realplexor::Common::logger,
+        false, // reuse_port
+        in_loop
+    ));
+    std::shared_ptr<Realplexor::Event::Server<Connection::InBinary>> in_binary;
+    if (!worker && CONFIG.in_binary_addr.length()) in_binary.reset(new Realplexor::Event::Server<Connection::InBinary>(
+        "IN_BINARY", // name
+        CONFIG.in_binary_addr, // listen
+        CONFIG.in_timeout, // timeout
+        &Realplexor::Common::logger,
+        false, // reuse_port
+        in_loop
+    ));
+
+    // Run IN line within its own thread: parsed requests are passed
+    // back to the main loop via the queue.
+    if (in && CONFIG.in_thread) {
+        Connection::In::queue = new Realplexor::Event::Queue<Connection::InRequest>(EV_DEFAULT, &Connection::In::process);
+        std::thread([in_loop]() {
+            // Signals are handled by the main thread only.
+            sigset_t set;
+            sigfillset(&set);
+            pthread_sigmask(SIG_BLOCK, &set, NULL);
+            Realplexor::Tools::loop = in_loop;
+            ev_run(in_loop, 0);
+        }).detach();
+    }
 
     // Catch signals.
     auto sigHupCallback = [&additional_conf](int revents) {
         LOGGER("SIGHUP received, reloading the config");
+        workers.kill(SIGHUP);
         string low_level_opt = CONFIG.reload(additional_conf);
         if (low_level_opt != "") {
             LOGGER("Low-level option \"" + low_level_opt + "\" is changed, restarting the script from scratch");
@@ -157,6 +218,7 @@ void mainloop()
         setuid(uid);
     }
 
+    loop_lag.start();
     Realplexor::Event::mainloop();
 }
 
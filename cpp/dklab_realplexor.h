@@ -38,24 +38,67 @@ typedef void (*logger_t)(const string&);
 // Cursor (precise).
 typedef unsigned long int cursor_t;
 
-// Identifier (channel name).
-typedef string ident_t;
+// Identifier (channel name). IDs are interned, so Storages key on
+// a pointer-sized handle instead of a string copy.
+typedef interned_string ident_t;
 
-// Set of IDs to match.
-typedef unordered_set<string> LimitIdsSet;
+// Set of IDs to match (it may be stored along with the data, so it
+// lives within the payload arena).
+typedef unordered_set<ident_t, std::hash<ident_t>, std::equal_to<ident_t>, arena_allocator<ident_t>> LimitIdsSet;
+
+// Keys of IDs (see interned_string::key()) sorted for intersection.
+typedef vector<const void*, arena_allocator<const void*>> IdKeyChain;
 
 // Set of IDs to send.
-typedef unordered_set<string> IdsToSendSet;
+typedef unordered_set<ident_t> IdsToSendSet;
+
+// Refcounted payload and limiters: they are shared by data queues of
+// many IDs and output queues of many connections. Counters are not
+// atomic (see local_ptr), so handles may be copied in fan-out loops.
+// Both objects and their data are allocated within the payload arena.
+typedef std::basic_string<char, std::char_traits<char>, arena_allocator<char>> arena_string;
+struct RefString: arena_string, local_refcounted {
+    RefString(const char* s, size_t n): arena_string(s, n) {}
+    RefString(const string& s, size_t pos = 0, size_t n = string::npos): arena_string(s.data() + pos, std::min(n, s.length() - pos)) {}
+    string str() const { return string(data(), length()); }
+    static void* operator new(size_t n) { return payload_arena::allocate(n); }
+    static void operator delete(void* p, size_t n) { payload_arena::deallocate(p, n); }
+};
+typedef local_ptr<RefString> DataRef;
+struct RefLimitIdsSet: LimitIdsSet, local_refcounted {
+    IdKeyChain keys; // built by index() when data is queued
+    void index()
+    {
+        keys.clear();
+        keys.reserve(size());
+        for (auto& id: *this) keys.push_back(id.key());
+        std::sort(keys.begin(), keys.end());
+    }
+    static void* operator new(size_t n) { return payload_arena::allocate(n); }
+    static void operator delete(void* p, size_t n) { payload_arena::deallocate(p, n); }
+};
+typedef local_ptr<RefLimitIdsSet> LimitIdsRef;
+
+// Chain of output buffers (payload buffers are shared, not copied).
+typedef vector<local_ptr<const RefString>> OutChunkChain;
 
 // Pair of listening WAIT data.
 struct DataPair {
     cursor_t cursor;
     ident_t id;
     DataPair() {}
-    DataPair(cursor_t cursor, ident_t id): cursor(cursor), id(id) {}
+    DataPair(cursor_t cursor, const ident_t& id): cursor(cursor), id(id) {}
 };
 typedef vector<DataPair> DataPairChain;
 
+// Record of a batch publish request: data to be sent to IDs.
+struct DataRecord {
+    DataPairChain pairs;
+    LimitIdsRef limit_ids;
+    DataRef rdata;
+};
+typedef vector<DataRecord> DataRecordChain;
+
 // Credentials.
 struct CredPair {
     string login;
@@ -80,7 +123,7 @@ struct DataEvent {
     ident_t id;
 
     DataEvent() {}
-    DataEvent(cursor_t cursor, DataEventType type, ident_t id): cursor(cursor), type(type), id(id) {}
+    DataEvent(cursor_t cursor, DataEventType type, const ident_t& id): cursor(cursor), type(type), id(id) {}
 
     std::string getType() const
     {
@@ -97,35 +140,51 @@ struct DataCursorFh {
     cursor_t cursor;
     fh_t fh;
     DataCursorFh() {}
-    DataCursorFh(cursor_t cursor, fh_t fh): cursor(cursor), fh(fh) {}
+    DataCursorFh(cursor_t cursor, const fh_t& fh): cursor(cursor), fh(fh) {}
 };
-typedef map<void*, DataCursorFh> DataCursorFhByFh;
+typedef flat_map<void*, DataCursorFh> DataCursorFhByFh;
 
 // Pice of data which was received and which must be sent.
+// The JSON fragment which precedes the data in responses is encoded
+// when the chunk is sent for the first time (see Common::_do_send()).
 struct DataChunk {
     cursor_t cursor;
-    shared_ptr<string> rdata;
-    shared_ptr<unordered_set<ident_t>> rlimit_ids;
-    DataChunk() {}
-    DataChunk(cursor_t cursor, shared_ptr<string> rdata, shared_ptr<unordered_set<ident_t>> rlimit_ids): cursor(cursor), rdata(rdata), rlimit_ids(rlimit_ids) {}
+    DataRef rdata;
+    LimitIdsRef rlimit_ids;
+    mutable DataRef fragment;
+    DataChunk(): cursor(0) {}
+    DataChunk(cursor_t cursor, const DataRef& rdata, const LimitIdsRef& rlimit_ids): cursor(cursor), rdata(rdata), rlimit_ids(rlimit_ids) {}
+};
+// Data chunks of an ID sorted by cursor (the oldest first).
+typedef ring<DataChunk> DataChunkChain;
+
+// Data item matched for a fh through one of the IDs it listens. Fan-out
+// collects them into one flat list which is then grouped by fh and by
+// data. It is built and sent while the fh and the data are referenced
+// by Storages, so raw pointers are held (copying handles for each
+// listener is not free).
+struct DataToSendItem
+{
+    Realplexor::Event::FH* fh;
+    const DataChunk* item;
+    const ident_t* id;
+    size_t seq; // order of matching
 };
-typedef list<DataChunk> DataChunkChain;
+typedef vector<DataToSendItem> DataToSendChain;
 
-// Piece of data ready to be sent to a fh.
+// Pair of ID and cursor reported to a client along with the data.
+typedef vector<std::pair<const ident_t*, cursor_t>> IdCursorChain;
+
+// Piece of data ready to be sent to a fh: the data and IDs (a range
+// within IdCursorChain) it is matched by.
 struct DataToSendChunk
 {
-    fh_t fh;
     cursor_t cursor;
-    shared_ptr<string> rdata;
-    map<ident_t, cursor_t> ids;
-    DataToSendChunk() {}
-private:
-    // Unfortunately we cannot disable copy constructor, because it is needed by std::map,
-    // mut we disable operator=.
-    DataToSendChunk& operator=(const DataToSendChunk& p);
+    const DataChunk* item; // of the first ID
+    size_t ids_from;
+    size_t ids_to;
 };
-typedef map<const string*, DataToSendChunk> DataToSendByDataRef;
-typedef map<const fh_t::element_type*, DataToSendByDataRef> DataToSendByFh;
+typedef vector<DataToSendChunk> DataToSendChunkChain;
 
 };
 #endif
@@ -32,43 +32,77 @@
 class Socket
 {
     int fh;
+    bool nonblocking;
+    // Peer address of an accepted TCP connection (formatted only when
+    // needed, mostly for logging); otherwise addr is used.
+    union {
+        struct sockaddr sa;
+        struct sockaddr_in in;
+        struct sockaddr_in6 in6;
+    } peer;
     string addr;
 
-    Socket(int fh): fh(fh) {}
     Socket(const Socket& s);
     Socket& operator=(const Socket& s);
 
 public:
 
-    // Creates a listening socket.
-    Socket(string localAddr): addr(localAddr)
+    // Creates a listening socket. Address may be in form of "host:port"
+    // (IPv4), "[host]:port" (IPv6) or "unix:/path" (Unix domain socket).
+    // If reuse_port is true, multiple processes may listen the same
+    // address (the kernel balances connections among them).
+    Socket(string localAddr, bool reuse_port = false): nonblocking(false), addr(localAddr)
     {
-        auto parts = split(":", localAddr);
-        if (parts.size() < 2) die("Address may be in form of \"host:port\", \"" + localAddr + "\" given");
-        fh = socket(AF_INET, SOCK_STREAM, 0);
+        peer.sa.sa_family = AF_UNSPEC;
+        struct sockaddr_storage serv_addr;
+        socklen_t serv_addr_len = _parse_addr(localAddr, serv_addr);
+        int family = serv_addr.ss_family;
+        fh = socket(family, SOCK_STREAM | SOCK_CLOEXEC, 0);
         if (fh < 0) die("ERROR calling socket(): $!");
 
-        // Avoid "address already in use" message at bind() stage.
         int opt = 1;
-        setsockopt(fh, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
-
-        struct sockaddr_in serv_addr;
-        memset(&serv_addr, 0, sizeof(serv_addr));
-        serv_addr.sin_family = AF_INET;
-        serv_addr.sin_addr.s_addr = inet_addr(parts[0].c_str());
-        serv_addr.sin_port = htons(lexical_cast<int>(parts[1]));
-        if (::bind(fh, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0) {
+        if (family == AF_UNIX) {
+            // The kernel cannot balance connections to the same socket file.
+            if (reuse_port) die("Unix domain socket cannot be shared by multiple processes");
+            // Remove the socket file left by a previous run.
+            const char* path = ((struct sockaddr_un*) &serv_addr)->sun_path;
+            struct stat st;
+            if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(path);
+        } else {
+            // Avoid "address already in use" message at bind() stage.
+            setsockopt(fh, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+            if (reuse_port && setsockopt(fh, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+                die("ERROR calling setsockopt(SO_REUSEPORT): $!");
+            }
+            if (family == AF_INET6) {
+                setsockopt(fh, IPPROTO_IPV6, IPV6_V6ONLY, &opt, sizeof(opt));
+            }
+        }
+
+        if (::bind(fh, (struct sockaddr *) &serv_addr, serv_addr_len) < 0) {
             die("ERROR calling bind(): $!");
         }
+        if (family == AF_UNIX) {
+            // Same as a loopback TCP port: any local user may connect
+            // (and then pass the authentication).
+            chmod(((struct sockaddr_un*) &serv_addr)->sun_path, 0666);
+        }
         listen(fh, 50000);
     }
 
-    // Creates an accepted socket.
-    Socket(int fh, const string& addr): fh(fh), addr(addr)
+    // Creates an accepted socket (or wraps a descriptor).
+    Socket(int fh, const string& addr, bool nonblocking = false): fh(fh), nonblocking(nonblocking), addr(addr)
     {
+        peer.sa.sa_family = AF_UNSPEC;
     }
 
-    virtual ~Socket()
+    // Creates an accepted TCP socket.
+    Socket(int fh, const struct sockaddr_storage& peer_addr, bool nonblocking): fh(fh), nonblocking(nonblocking)
+    {
+        memcpy(&peer, &peer_addr, std::min(sizeof(peer), sizeof(peer_addr)));
+    }
+
+    ~Socket()
     {
         close(fh);
     }
@@ -80,24 +114,40 @@ public:
 
     string peeraddr()
     {
+        if (peer.sa.sa_family == AF_INET) {
+            return string(inet_ntoa(peer.in.sin_addr)) + ":" + lexical_cast<string>(peer.in.sin_port);
+        } else if (peer.sa.sa_family == AF_INET6) {
+            char buf[INET6_ADDRSTRLEN];
+            inet_ntop(AF_INET6, &peer.in6.sin6_addr, buf, sizeof(buf));
+            return "[" + string(buf) + "]:" + lexical_cast<string>(peer.in6.sin6_port);
+        }
         return addr;
     }
 
     void blocking(bool block)
     {
+        if (nonblocking == !block) return;
+        nonblocking = !block;
         int flags = fcntl(fh, F_GETFL, 0);
         fcntl(fh, F_SETFL, block? (flags & (~O_NONBLOCK)) : (flags | O_NONBLOCK));
     }
 
+    // Accepts a pending connection; the new socket is non-blocking.
+    // Returns an empty pointer in case of error (see errno), e.g. if
+    // there are no more pending connections.
     std::shared_ptr<Socket> accept()
     {
-        struct sockaddr_in cli_addr;
+        struct sockaddr_storage cli_addr;
         socklen_t clilen = sizeof(cli_addr);
-        int newsockfd = ::accept(fh, (struct sockaddr *) &cli_addr, &clilen);
+        int newsockfd = ::accept4(fh, (struct sockaddr *) &cli_addr, &clilen, SOCK_NONBLOCK | SOCK_CLOEXEC);
         if (newsockfd < 0) {
-            die("ERROR calling accept(): $!");
+            return std::shared_ptr<Socket>();
         }
-        return std::shared_ptr<Socket>(new Socket(newsockfd, string(inet_ntoa(cli_addr.sin_addr)) + ":" + lexical_cast<string>(cli_addr.sin_port)));
+        if (cli_addr.ss_family == AF_INET || cli_addr.ss_family == AF_INET6) {
+            return make_slab_shared<Socket>(newsockfd, cli_addr, true);
+        }
+        // Unix domain socket clients are unnamed.
+        return make_slab_shared<Socket>(newsockfd, addr, true);
     }
 
     // Appends read data to the end of the string.
@@ -109,6 +159,8 @@ public:
             char buf[1024 * 32];
             int n = ::read(fh, buf, sizeof(buf));
             if (n < 0) {
+                // Previous chunk was exactly of buffer size.
+                if (nread && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
                 die("ERROR calling read(): $!");
             }
             s.append(buf, n);
@@ -118,24 +170,36 @@ public:
         return nread;
     }
 
-    // Returns:
-    // - 1 if the operation succeeded
-    // - 0 if nothing was sent
-    // - -1 in case of an error
-    int send(const char* buf, size_t len)
+    // Writes as much data as the socket accepts without blocking.
+    // Returns the number of written bytes (0 if the socket buffer is
+    // full and the caller should wait for writability) or -1 in case
+    // of an error.
+    ssize_t write_some(const char* buf, size_t len)
     {
-        while (true) {
-            int n = ::write(fh, buf, len);
-            if (n < 0) return -1;
-            if (n == (int)len) return 1;
-            len -= n;
-            buf += n;
+        size_t written = 0;
+        while (written < len) {
+            ssize_t n = ::write(fh, buf + written, len - written);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                return -1;
+            }
+            written += n;
         }
+        return written;
     }
 
-    int send(const string& s)
+    // Same as write_some(), but gathers data from multiple buffers
+    // with a single writev() call.
+    ssize_t writev_some(const struct iovec* iov, int iovcnt)
     {
-        return send(s.c_str(), s.length());
+        while (true) {
+            ssize_t n = ::writev(fh, iov, iovcnt);
+            if (n >= 0) return n;
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            return -1;
+        }
     }
 
     // Returns 0 on error, 1 on success.
@@ -143,6 +207,42 @@ public:
     {
         return ::shutdown(fh, how) < 0? 0 : 1;
     }
+
+private:
+
+    // Parses the listening address and returns the length of the
+    // filled structure.
+    static socklen_t _parse_addr(const string& localAddr, struct sockaddr_storage& sa)
+    {
+        memset(&sa, 0, sizeof(sa));
+        boost::smatch m;
+        if (starts_with(localAddr, "unix:")) {
+            string path = localAddr.substr(5);
+            struct sockaddr_un* a = (struct sockaddr_un*) &sa;
+            if (!path.length() || path.length() >= sizeof(a->sun_path)) {
+                die("Unix socket path is empty or too long: \"" + localAddr + "\"");
+            }
+            a->sun_family = AF_UNIX;
+            strcpy(a->sun_path, path.c_str());
+            return sizeof(*a);
+        } else if (regex_match(localAddr, m, regex("\\[([^\\]]+)\\]:(\\d+)"))) {
+            struct sockaddr_in6* a = (struct sockaddr_in6*) &sa;
+            a->sin6_family = AF_INET6;
+            if (inet_pton(AF_INET6, string(m[1]).c_str(), &a->sin6_addr) != 1) {
+                die("Invalid IPv6 address: \"" + localAddr + "\"");
+            }
+            a->sin6_port = htons(lexical_cast<int>(m[2]));
+            return sizeof(*a);
+        } else {
+            auto parts = split(":", localAddr);
+            if (parts.size() < 2) die("Address may be in form of \"host:port\", \"[host]:port\" or \"unix:/path\", \"" + localAddr + "\" given");
+            struct sockaddr_in* a = (struct sockaddr_in*) &sa;
+            a->sin_family = AF_INET;
+            a->sin_addr.s_addr = inet_addr(parts[0].c_str());
+            a->sin_port = htons(lexical_cast<int>(parts[1]));
+            return sizeof(*a);
+        }
+    }
 };
 
 #endif
@@ -0,0 +1,379 @@
+//@
+//@ Dklab Realplexor: Comet server which handles 1000000+ parallel browser connections
+//@ Author: Dmitry Koterov, dkLab (C)
+//@ License: GPL 2.0
+//@
+//@ 2025-* Contributor: Alexxiy
+//@ GitHub: http://github.com/alexxiy/
+//@
+//@ ATTENTION: Java-style C++ programming below. :-)
+//@
+//@ This is a line-by-line C++ rewrite of Perl prototype code with obvious speed
+//@ optimizations (like avoiding excess copies, config pre-parsing etc.).
+//@
+//@ The code is so compact (2600 lines) and so simple, that I decided not to
+//@ split it into *.hpp & *.cpp files nor create Makefiles, but place
+//@ everything into included *.h files (like Perl, Java, C# and most of other
+//@ languages do). It is not quite common for C++, but it surely simple
+//@ when a program is small (especially when it is rewritten line by line
+//@ from another language).
+//@
+//@ Also the code has global variables within the top namespace: one variable
+//@ per Storage and one CONFIG, they are like singletons.
+//@
+
+#ifndef UTILS_ARENA_H
+#define UTILS_ARENA_H
+
+//
+// Size-classed slab arena for message payloads and limiter sets. These
+// blocks have a wide range of sizes and lifetimes, so with malloc() they
+// fragment the heap and RSS drifts up. Here each slab holds blocks of one
+// size class only, and a slab is unmapped as soon as all its blocks are
+// free (except the last one of its class), so memory freed by rotating
+// data queues goes back to the system. Blocks larger than MAX_BLOCK are
+// allocated by malloc().
+//
+// There is one arena per thread (the IN thread builds payloads which the
+// main thread frees). A block freed by another thread is pushed to the
+// owner's lock-free list and is reclaimed by the owner on its next
+// allocation. Arenas live until the process exits: the arena of an
+// exited thread (e.g. of a recreated thread pool) is adopted by the
+// next thread which needs one, with all blocks freed into it since.
+//
+class payload_arena
+{
+public:
+    static const size_t SLAB_SIZE = 65536;
+    static const size_t MAX_BLOCK = 16384;
+
+private:
+    // Power of 2 sizes with intermediate steps (waste is at most 1/3).
+    static constexpr size_t CLASS_SIZES[] = {
+        32, 48, 64, 96, 128, 192, 256, 384, 512, 768,
+        1024, 1536, 2048, 3072, 4096, 6144, 8192, 12288, 16384
+    };
+    static const size_t NUM_CLASSES = sizeof(CLASS_SIZES) / sizeof(CLASS_SIZES[0]);
+
+    // Free block; size is set only for blocks freed by other threads.
+    struct block
+    {
+        block* next;
+        size_t size;
+    };
+
+    // Slab header; blocks follow it within the same aligned region.
+    struct slab
+    {
+        payload_arena* owner;
+        slab* prev;
+        slab* next;
+        block* free;
+        char* unused;
+        size_t used;
+        size_t cls;
+    };
+
+    struct size_class
+    {
+        // Slabs which have free blocks, the one to allocate from first.
+        slab* partial;
+        slab* partial_tail;
+        std::atomic<size_t> slabs;
+        std::atomic<size_t> used;
+    };
+
+    size_class _classes[NUM_CLASSES];
+    alignas(64) std::atomic<block*> _remote;
+    std::atomic<size_t> _requested;
+
+    static thread_local payload_arena* _local;
+
+    // Releases the arena of an exiting thread.
+    struct thread_exit
+    {
+        bool armed;
+        ~thread_exit()
+        {
+            if (!armed || !_local) return;
+            std::lock_guard<std::mutex> lock(_registry_mutex());
+            _orphans().push_back(_local);
+            _local = NULL;
+        }
+    };
+    static thread_local thread_exit _thread_exit;
+    static std::atomic<size_t> _large_num;
+    static std::atomic<size_t> _large_bytes;
+
+    payload_arena(): _remote(NULL), _requested(0)
+    {
+        for (auto& c: _classes) {
+            c.partial = c.partial_tail = NULL;
+            c.slabs = 0;
+            c.used = 0;
+        }
+        std::lock_guard<std::mutex> lock(_registry_mutex());
+        _registry().push_back(this);
+    }
+
+public:
+
+    static void* allocate(size_t n)
+    {
+        if (n > MAX_BLOCK) {
+            _large_num.fetch_add(1, std::memory_order_relaxed);
+            _large_bytes.fetch_add(n, std::memory_order_relaxed);
+            return ::operator new(n);
+        }
+        if (!_local) _local = _acquire();
+        return _local->_allocate(n);
+    }
+
+    // The size must be the same as passed to allocate().
+    static void deallocate(void* p, size_t n)
+    {
+        if (n > MAX_BLOCK) {
+            _large_num.fetch_sub(1, std::memory_order_relaxed);
+            _large_bytes.fetch_sub(n, std::memory_order_relaxed);
+            ::operator delete(p);
+            return;
+        }
+        slab* s = _slab_of(p);
+        if (s->owner == _local) {
+            s->owner->_free(s, static_cast<block*>(p), n);
+            return;
+        }
+        block* b = static_cast<block*>(p);
+        b->size = n;
+        b->next = s->owner->_remote.load(std::memory_order_relaxed);
+        while (!s->owner->_remote.compare_exchange_weak(b->next, b, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    // Returns statistics of all arenas (approximate if other threads
+    // allocate at the same time).
+    static std::string get_stats()
+    {
+        size_t slabs[NUM_CLASSES] = {}, used[NUM_CLASSES] = {}, requested = 0;
+        {
+            std::lock_guard<std::mutex> lock(_registry_mutex());
+            for (payload_arena* arena: _registry()) {
+                for (size_t i = 0; i < NUM_CLASSES; i++) {
+                    slabs[i] += arena->_classes[i].slabs.load(std::memory_order_relaxed);
+                    used[i] += arena->_classes[i].used.load(std::memory_order_relaxed);
+                }
+                requested += arena->_requested.load(std::memory_order_relaxed);
+            }
+        }
+        std::string result;
+        size_t total_slabs = 0, total_used = 0;
+        for (size_t i = 0; i < NUM_CLASSES; i++) {
+            if (!slabs[i]) continue;
+            total_slabs += slabs[i];
+            total_used += used[i] * CLASS_SIZES[i];
+            result +=
+                "class " + std::to_string(CLASS_SIZES[i]) + ": " +
+                std::to_string(slabs[i]) + " slabs, " +
+                std::to_string(used[i]) + "/" + std::to_string(slabs[i] * _blocks_per_slab(i)) + " blocks used\n";
+        }
+        size_t mapped = total_slabs * SLAB_SIZE;
+        result +=
+            "slabs: " + std::to_string(mapped) + " bytes mapped, " +
+            std::to_string(total_used) + " in blocks, " +
+            std::to_string(requested) + " requested" +
+            (mapped? " (" + std::to_string(100 - requested * 100 / mapped) + "% overhead)" : "") + "\n" +
+            "large: " + std::to_string(_large_num.load(std::memory_order_relaxed)) + " blocks, " +
+            std::to_string(_large_bytes.load(std::memory_order_relaxed)) + " bytes\n";
+        return result;
+    }
+
+private:
+
+    // Returns an arena left by an exited thread or a new one.
+    static payload_arena* _acquire()
+    {
+        _thread_exit.armed = true;
+        {
+            std::lock_guard<std::mutex> lock(_registry_mutex());
+            if (_orphans().size()) {
+                payload_arena* arena = _orphans().back();
+                _orphans().pop_back();
+                return arena;
+            }
+        }
+        return new payload_arena();
+    }
+
+    void* _allocate(size_t n)
+    {
+        if (_remote.load(std::memory_order_relaxed)) _reclaim();
+        size_t cls = _class_of(n);
+        size_class& c = _classes[cls];
+        slab* s = c.partial;
+        if (!s) s = c.partial = c.partial_tail = _new_slab(cls);
+        block* b = s->free;
+        if (b) {
+            s->free = b->next;
+        } else {
+            b = reinterpret_cast<block*>(s->unused);
+            s->unused += CLASS_SIZES[cls];
+        }
+        s->used++;
+        if (!s->free && !_can_carve(s)) _unlink(s);
+        _counter_add(c.used, 1);
+        _counter_add(_requested, n);
+        return b;
+    }
+
+    void _free(slab* s, block* b, size_t n)
+    {
+        size_class& c = _classes[s->cls];
+        bool was_full = !s->free && !_can_carve(s);
+        b->next = s->free;
+        s->free = b;
+        s->used--;
+        _counter_add(c.used, -1);
+        _counter_add(_requested, -n);
+        if (was_full) {
+            // Link to the end, so allocations go to fuller slabs first.
+            s->prev = c.partial_tail;
+            if (s->prev) s->prev->next = s;
+            else c.partial = s;
+            c.partial_tail = s;
+        }
+        if (!s->used && (c.partial != s || s->next)) {
+            _unlink(s);
+            munmap(s, SLAB_SIZE);
+            _counter_add(c.slabs, -1);
+        }
+    }
+
+    // Frees blocks which were freed by other threads.
+    void _reclaim()
+    {
+        block* b = _remote.exchange(NULL, std::memory_order_acquire);
+        while (b) {
+            block* next = b->next;
+            _free(_slab_of(b), b, b->size);
+            b = next;
+        }
+    }
+
+    slab* _new_slab(size_t cls)
+    {
+        // Map twice the size and cut off the excess to align the slab.
+        char* p = static_cast<char*>(mmap(NULL, SLAB_SIZE * 2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+        if (p == MAP_FAILED) throw std::bad_alloc();
+        char* aligned = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(p) + SLAB_SIZE - 1) & ~(SLAB_SIZE - 1));
+        if (aligned > p) munmap(p, aligned - p);
+        munmap(aligned + SLAB_SIZE, p + SLAB_SIZE - aligned);
+        slab* s = reinterpret_cast<slab*>(aligned);
+        s->owner = this;
+        s->prev = s->next = NULL;
+        s->free = NULL;
+        s->unused = aligned + _header_size();
+        s->used = 0;
+        s->cls = cls;
+        _counter_add(_classes[cls].slabs, 1);
+        return s;
+    }
+
+    void _unlink(slab* s)
+    {
+        size_class& c = _classes[s->cls];
+        if (s->prev) s->prev->next = s->next;
+        else c.partial = s->next;
+        if (s->next) s->next->prev = s->prev;
+        else c.partial_tail = s->prev;
+        s->prev = s->next = NULL;
+    }
+
+    bool _can_carve(slab* s)
+    {
+        return s->unused + CLASS_SIZES[s->cls] <= reinterpret_cast<char*>(s) + SLAB_SIZE;
+    }
+
+    // Counters are written by the owner only, so no locked operations.
+    static void _counter_add(std::atomic<size_t>& counter, size_t delta)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+    }
+
+    static slab* _slab_of(void* p)
+    {
+        return reinterpret_cast<slab*>(reinterpret_cast<uintptr_t>(p) & ~(SLAB_SIZE - 1));
+    }
+
+    static size_t _class_of(size_t n)
+    {
+        // Index by 16-byte granules, filled on the first call.
+        static const std::vector<unsigned char> by_granule = []() {
+            std::vector<unsigned char> v(MAX_BLOCK / 16 + 1);
+            size_t cls = 0;
+            for (size_t g = 0; g < v.size(); g++) {
+                while (CLASS_SIZES[cls] < g * 16) cls++;
+                v[g] = cls;
+            }
+            return v;
+        }();
+        return by_granule[(n + 15) / 16];
+    }
+
+    static size_t _header_size()
+    {
+        return (sizeof(slab) + 15) / 16 * 16;
+    }
+
+    static size_t _blocks_per_slab(size_t cls)
+    {
+        return (SLAB_SIZE - _header_size()) / CLASS_SIZES[cls];
+    }
+
+    static std::mutex& _registry_mutex()
+    {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    static std::vector<payload_arena*>& _registry()
+    {
+        static std::vector<payload_arena*> registry;
+        return registry;
+    }
+
+    static std::vector<payload_arena*>& _orphans()
+    {
+        static std::vector<payload_arena*> orphans;
+        return orphans;
+    }
+};
+
+thread_local payload_arena* payload_arena::_local = NULL;
+thread_local payload_arena::thread_exit payload_arena::_thread_exit;
+std::atomic<size_t> payload_arena::_large_num(0);
+std::atomic<size_t> payload_arena::_large_bytes(0);
+
+// Standard allocator over the payload arena (e.g. for containers of
+// payload and limiter data).
+template<typename T>
+struct arena_allocator
+{
+    typedef T value_type;
+
+    arena_allocator() {}
+    template<typename U> arena_allocator(const arena_allocator<U>&) {}
+
+    T* allocate(size_t n)
+    {
+        return static_cast<T*>(payload_arena::allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, size_t n)
+    {
+        payload_arena::deallocate(p, n * sizeof(T));
+    }
+
+    template<typename U> bool operator==(const arena_allocator<U>&) const { return true; }
+    template<typename U> bool operator!=(const arena_allocator<U>&) const { return false; }
+};
+
+#endif
@@ -0,0 +1,246 @@
+//@
+//@ Dklab Realplexor: Comet server which handles 1000000+ parallel browser connections
+//@ Author: Dmitry Koterov, dkLab (C)
+//@ License: GPL 2.0
+//@
+//@ 2025-* Contributor: Alexxiy
+//@ GitHub: http://github.com/alexxiy/
+//@
+//@ ATTENTION: Java-style C++ programming below. :-)
+//@
+//@ This is a line-by-line C++ rewrite of Perl prototype code with obvious speed
+//@ optimizations (like avoiding excess copies, config pre-parsing etc.).
+//@
+//@ The code is so compact (2600 lines) and so simple, that I decided not to
+//@ split it into *.hpp & *.cpp files nor create Makefiles, but place
+//@ everything into included *.h files (like Perl, Java, C# and most of other
+//@ languages do). It is not quite common for C++, but it surely simple
+//@ when a program is small (especially when it is rewritten line by line
+//@ from another language).
+//@
+//@ Also the code has global variables within the top namespace: one variable
+//@ per Storage and one CONFIG, they are like singletons.
+//@
+
+#ifndef UTILS_FLAT_MAP_H
+#define UTILS_FLAT_MAP_H
+
+//
+// Hash map with open addressing (linear probing) over a single flat
+// array of slots: a lookup is one hash and usually one cache line,
+// without node allocations and pointer chasing of std::map.
+//
+// Unlike std::unordered_map, any insertion or erasure invalidates
+// iterators and references to elements (elements are moved within the
+// array). Iteration order is unspecified: sort keys for stable output.
+//
+template<typename K, typename V, typename Hash = std::hash<K>>
+class flat_map
+{
+public:
+    typedef K key_type;
+    typedef V mapped_type;
+    typedef std::pair<K, V> value_type;
+
+private:
+    struct slot
+    {
+        bool used;
+        alignas(value_type) unsigned char data[sizeof(value_type)];
+        value_type& kv() { return *std::launder(reinterpret_cast<value_type*>(data)); }
+        const value_type& kv() const { return *std::launder(reinterpret_cast<const value_type*>(data)); }
+    };
+
+    slot* _slots;
+    size_t _capacity; // 0 or a power of 2
+    size_t _size;
+    int _shift;       // 64 - log2(_capacity)
+
+    template<typename S, typename T>
+    class basic_iterator
+    {
+        friend class flat_map;
+        S* _p;
+        S* _end;
+        basic_iterator(S* p, S* end): _p(p), _end(end)
+        {
+            while (_p != _end && !_p->used) _p++;
+        }
+    public:
+        T& operator*() const { return _p->kv(); }
+        T* operator->() const { return &_p->kv(); }
+        basic_iterator& operator++()
+        {
+            do _p++; while (_p != _end && !_p->used);
+            return *this;
+        }
+        bool operator==(const basic_iterator& it) const { return _p == it._p; }
+        bool operator!=(const basic_iterator& it) const { return _p != it._p; }
+    };
+
+public:
+    typedef basic_iterator<slot, value_type> iterator;
+    typedef basic_iterator<const slot, const value_type> const_iterator;
+
+    flat_map(): _slots(NULL), _capacity(0), _size(0), _shift(64) {}
+
+    flat_map(const flat_map& m): flat_map()
+    {
+        for (auto& kv: m) (*this)[kv.first] = kv.second;
+    }
+
+    flat_map(flat_map&& m): _slots(m._slots), _capacity(m._capacity), _size(m._size), _shift(m._shift)
+    {
+        m._slots = NULL;
+        m._capacity = m._size = 0;
+        m._shift = 64;
+    }
+
+    ~flat_map()
+    {
+        clear();
+    }
+
+    flat_map& operator=(flat_map m)
+    {
+        std::swap(_slots, m._slots);
+        std::swap(_capacity, m._capacity);
+        std::swap(_size, m._size);
+        std::swap(_shift, m._shift);
+        return *this;
+    }
+
+    iterator begin() { return iterator(_slots, _slots + _capacity); }
+    iterator end() { return iterator(_slots + _capacity, _slots + _capacity); }
+    const_iterator begin() const { return const_iterator(_slots, _slots + _capacity); }
+    const_iterator end() const { return const_iterator(_slots + _capacity, _slots + _capacity); }
+
+    size_t size() const { return _size; }
+    bool empty() const { return !_size; }
+
+    iterator find(const K& key)
+    {
+        slot* s = _lookup(key);
+        return s? iterator(s, _slots + _capacity) : end();
+    }
+
+    const_iterator find(const K& key) const
+    {
+        const slot* s = const_cast<flat_map*>(this)->_lookup(key);
+        return s? const_iterator(s, _slots + _capacity) : end();
+    }
+
+    size_t count(const K& key) const
+    {
+        return const_cast<flat_map*>(this)->_lookup(key)? 1 : 0;
+    }
+
+    V& operator[](const K& key)
+    {
+        if (_capacity) {
+            size_t i = _home(key);
+            for (; _slots[i].used; i = (i + 1) & (_capacity - 1)) {
+                if (_slots[i].kv().first == key) return _slots[i].kv().second;
+            }
+            if ((_size + 1) * 4 <= _capacity * 3) {
+                _size++;
+                return _construct(_slots[i], value_type(key, V())).second;
+            }
+        }
+        K copy(key); // key may refer to an element being moved
+        _grow();
+        return (*this)[copy];
+    }
+
+    size_t erase(const K& key)
+    {
+        slot* s = _lookup(key);
+        if (!s) return 0;
+        _erase(s - _slots);
+        return 1;
+    }
+
+    void erase(iterator it)
+    {
+        _erase(it._p - _slots);
+    }
+
+    void clear()
+    {
+        for (size_t i = 0; i < _capacity; i++) {
+            if (_slots[i].used) _slots[i].kv().~value_type();
+        }
+        delete[] _slots;
+        _slots = NULL;
+        _capacity = _size = 0;
+        _shift = 64;
+    }
+
+private:
+
+    // Fibonacci hashing: spreads e.g. aligned pointers over all slots.
+    size_t _home(const K& key) const
+    {
+        return (uint64_t(Hash()(key)) * 0x9E3779B97F4A7C15ull) >> _shift;
+    }
+
+    slot* _lookup(const K& key)
+    {
+        if (!_size) return NULL;
+        for (size_t i = _home(key); _slots[i].used; i = (i + 1) & (_capacity - 1)) {
+            if (_slots[i].kv().first == key) return &_slots[i];
+        }
+        return NULL;
+    }
+
+    static value_type& _construct(slot& s, value_type&& kv)
+    {
+        new (s.data) value_type(std::move(kv));
+        s.used = true;
+        return s.kv();
+    }
+
+    void _grow()
+    {
+        slot* old = _slots;
+        size_t old_capacity = _capacity;
+        _capacity = _capacity? _capacity * 2 : 2;
+        _shift = 64 - __builtin_ctzll(_capacity);
+        _slots = new slot[_capacity];
+        for (size_t i = 0; i < _capacity; i++) _slots[i].used = false;
+        for (size_t i = 0; i < old_capacity; i++) {
+            if (!old[i].used) continue;
+            size_t j = _home(old[i].kv().first);
+            while (_slots[j].used) j = (j + 1) & (_capacity - 1);
+            _construct(_slots[j], std::move(old[i].kv()));
+            old[i].kv().~value_type();
+        }
+        delete[] old;
+    }
+
+    // Backward shift deletion: elements after the erased one are moved
+    // back if it is closer to their home slot, so there is no need in
+    // "deleted" marks and lookups never become longer.
+    void _erase(size_t i)
+    {
+        _slots[i].kv().~value_type();
+        _slots[i].used = false;
+        _size--;
+        if (!_size) {
+            // Release memory of a map which is not used anymore.
+            clear();
+            return;
+        }
+        for (size_t j = (i + 1) & (_capacity - 1); _slots[j].used; j = (j + 1) & (_capacity - 1)) {
+            size_t home = _home(_slots[j].kv().first);
+            // Leave the element if its home is cyclically within (i, j].
+            if (i <= j? (i < home && home <= j) : (i < home || home <= j)) continue;
+            _construct(_slots[i], std::move(_slots[j].kv()));
+            _slots[j].kv().~value_type();
+            _slots[j].used = false;
+            i = j;
+        }
+    }
+};
+
+#endif
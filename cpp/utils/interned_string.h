@@ -0,0 +1,200 @@
+//@
+//@ Dklab Realplexor: Comet server which handles 1000000+ parallel browser connections
+//@ Author: Dmitry Koterov, dkLab (C)
+//@ License: GPL 2.0
+//@
+//@ 2025-* Contributor: Alexxiy
+//@ GitHub: http://github.com/alexxiy/
+//@
+//@ ATTENTION: Java-style C++ programming below. :-)
+//@
+//@ This is a line-by-line C++ rewrite of Perl prototype code with obvious speed
+//@ optimizations (like avoiding excess copies, config pre-parsing etc.).
+//@
+//@ The code is so compact (2600 lines) and so simple, that I decided not to
+//@ split it into *.hpp & *.cpp files nor create Makefiles, but place
+//@ everything into included *.h files (like Perl, Java, C# and most of other
+//@ languages do). It is not quite common for C++, but it surely simple
+//@ when a program is small (especially when it is rewritten line by line
+//@ from another language).
+//@
+//@ Also the code has global variables within the top namespace: one variable
+//@ per Storage and one CONFIG, they are like singletons.
+//@
+
+#ifndef UTILS_INTERNED_STRING_H
+#define UTILS_INTERNED_STRING_H
+
+//
+// Immutable string interned in a global table: equal strings share the
+// same refcounted entry, so copying, hashing and comparing for equality
+// deal with a pointer only. The entry is freed when its last reference
+// is gone. Strings may be created and destroyed by different threads.
+//
+// The handle is the entry address, not an index into a table: str()
+// needs no lookup and no lock (the IN thread interns IDs too), and a
+// freed ID cannot be mistaken for a new one reusing its slot. The price
+// is 8 bytes per handle instead of 4, an atomic increment per copy and
+// the table mutex taken when the last reference to an ID is released.
+//
+class interned_string
+{
+    struct entry
+    {
+        string value;
+        std::atomic<unsigned> refs;
+        entry(std::string_view value): value(value), refs(1) {}
+    };
+
+    struct table
+    {
+        std::mutex mutex;
+        unordered_map<std::string_view, entry*> entries;
+    };
+
+    entry* _e;
+
+public:
+    interned_string(): _e(NULL) {}
+
+    explicit interned_string(const string& value)
+    {
+        _intern(value);
+    }
+
+    interned_string(const char* begin, const char* end)
+    {
+        _intern(std::string_view(begin, end - begin));
+    }
+
+    interned_string(const interned_string& s): _e(s._e)
+    {
+        if (_e) _e->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    interned_string(interned_string&& s): _e(s._e)
+    {
+        s._e = NULL;
+    }
+
+    ~interned_string()
+    {
+        _release();
+    }
+
+    interned_string& operator=(interned_string s)
+    {
+        std::swap(_e, s._e);
+        return *this;
+    }
+
+    const string& str() const
+    {
+        static const string empty;
+        return _e? _e->value : empty;
+    }
+
+    bool operator==(const interned_string& s) const
+    {
+        return _e == s._e;
+    }
+
+    bool operator!=(const interned_string& s) const
+    {
+        return _e != s._e;
+    }
+
+    // Ordered by value (not by address), e.g. for stable output.
+    bool operator<(const interned_string& s) const
+    {
+        return str() < s.str();
+    }
+
+    // Address of the shared entry: equal strings have equal keys, so
+    // sorted lists of keys may be intersected without string compares.
+    const void* key() const
+    {
+        return _e;
+    }
+
+    size_t hash() const
+    {
+        return std::hash<entry*>()(_e);
+    }
+
+    // Returns the number of distinct strings currently interned.
+    static size_t count()
+    {
+        table& t = _table();
+        std::lock_guard<std::mutex> lock(t.mutex);
+        return t.entries.size();
+    }
+
+private:
+
+    // The table is never destroyed: global objects may hold strings
+    // until the very end of the process.
+    static table& _table()
+    {
+        static table* t = new table();
+        return *t;
+    }
+
+    void _intern(std::string_view value)
+    {
+        table& t = _table();
+        std::lock_guard<std::mutex> lock(t.mutex);
+        auto it = t.entries.find(value);
+        if (it != t.entries.end()) {
+            _e = it->second;
+            _e->refs.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            _e = new entry(value);
+            t.entries.emplace(std::string_view(_e->value), _e);
+        }
+    }
+
+    void _release()
+    {
+        if (!_e) return;
+        // Not the last reference: no need to lock the table.
+        unsigned refs = _e->refs.load(std::memory_order_relaxed);
+        while (refs > 1) {
+            if (_e->refs.compare_exchange_weak(refs, refs - 1, std::memory_order_acq_rel)) {
+                _e = NULL;
+                return;
+            }
+        }
+        // Probably the last one: the string may be interned again by
+        // another thread meanwhile, so check it under the lock.
+        table& t = _table();
+        std::lock_guard<std::mutex> lock(t.mutex);
+        if (_e->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            t.entries.erase(std::string_view(_e->value));
+            delete _e;
+        }
+        _e = NULL;
+    }
+};
+
+// Returns values of interned strings (e.g. to join them).
+template<typename Container>
+vector<string> interned_strs(const Container& c)
+{
+    vector<string> result;
+    result.reserve(c.size());
+    for (auto& s: c) result.push_back(s.str());
+    return result;
+}
+
+namespace std {
+template<> struct hash<interned_string>
+{
+    size_t operator()(const interned_string& s) const
+    {
+        return s.hash();
+    }
+};
+}
+
+#endif
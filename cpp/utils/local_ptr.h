@@ -0,0 +1,129 @@
+//@
+//@ Dklab Realplexor: Comet server which handles 1000000+ parallel browser connections
+//@ Author: Dmitry Koterov, dkLab (C)
+//@ License: GPL 2.0
+//@
+//@ 2025-* Contributor: Alexxiy
+//@ GitHub: http://github.com/alexxiy/
+//@
+//@ ATTENTION: Java-style C++ programming below. :-)
+//@
+//@ This is a line-by-line C++ rewrite of Perl prototype code with obvious speed
+//@ optimizations (like avoiding excess copies, config pre-parsing etc.).
+//@
+//@ The code is so compact (2600 lines) and so simple, that I decided not to
+//@ split it into *.hpp & *.cpp files nor create Makefiles, but place
+//@ everything into included *.h files (like Perl, Java, C# and most of other
+//@ languages do). It is not quite common for C++, but it surely simple
+//@ when a program is small (especially when it is rewritten line by line
+//@ from another language).
+//@
+//@ Also the code has global variables within the top namespace: one variable
+//@ per Storage and one CONFIG, they are like singletons.
+//@
+
+#ifndef UTILS_LOCAL_PTR_H
+#define UTILS_LOCAL_PTR_H
+
+//
+// Intrusive refcounting without atomic operations. The binary is built
+// with -pthread, so each std::shared_ptr copy is a locked increment and
+// decrement; payloads are copied per listener during fan-out, so it is
+// worth avoiding. The counter lives within the object itself, so a handle
+// may be recreated from a raw pointer, and only one allocation is needed.
+//
+// All references to an object must be owned by one thread at a time: it
+// may be passed to another thread only together with all of them (e.g.
+// moved into a request passed via Event::Queue).
+//
+class local_refcounted
+{
+    template<typename T> friend class local_ptr;
+    mutable size_t _refs;
+
+protected:
+    local_refcounted(): _refs(0) {}
+    local_refcounted(const local_refcounted&): _refs(0) {}
+    local_refcounted& operator=(const local_refcounted&) { return *this; }
+};
+
+template<typename T>
+class local_ptr
+{
+    template<typename U> friend class local_ptr;
+    T* _p;
+
+public:
+    local_ptr(): _p(NULL) {}
+
+    // Takes a (new) reference to the object.
+    local_ptr(T* p): _p(p)
+    {
+        if (_p) _p->_refs++;
+    }
+
+    local_ptr(const local_ptr& other): local_ptr(other._p) {}
+    template<typename U> local_ptr(const local_ptr<U>& other): local_ptr(other._p) {}
+
+    local_ptr(local_ptr&& other): _p(other._p)
+    {
+        other._p = NULL;
+    }
+
+    template<typename U> local_ptr(local_ptr<U>&& other): _p(other._p)
+    {
+        other._p = NULL;
+    }
+
+    ~local_ptr()
+    {
+        _release();
+    }
+
+    local_ptr& operator=(const local_ptr& other)
+    {
+        if (other._p) other._p->_refs++;
+        _release();
+        _p = other._p;
+        return *this;
+    }
+
+    local_ptr& operator=(local_ptr&& other)
+    {
+        if (this != &other) {
+            _release();
+            _p = other._p;
+            other._p = NULL;
+        }
+        return *this;
+    }
+
+    void swap(local_ptr& other)
+    {
+        std::swap(_p, other._p);
+    }
+
+    void reset()
+    {
+        local_ptr().swap(*this);
+    }
+
+    T* get() const { return _p; }
+    T& operator*() const { return *_p; }
+    T* operator->() const { return _p; }
+    explicit operator bool() const { return _p != NULL; }
+
+private:
+    void _release()
+    {
+        if (_p && !--_p->_refs) delete _p;
+    }
+};
+
+template<typename T, typename... Args>
+local_ptr<T> make_local(Args&&... args)
+{
+    return local_ptr<T>(new T(std::forward<Args>(args)...));
+}
+
+#endif
@@ -135,19 +135,4 @@ void strip_comments(string& line)
     trim(line);
 }
 
-bool get_http_body(const string& data, size_t& pos)
-{
-    size_t d = 2;
-    size_t p = data.find("\n\n");
-    if (p == data.npos) {
-        d = 3;
-        p = data.find("\n\r\n");
-    }
-    if (p != data.npos) {
-        pos = p + d;
-        return true;
-    }
-    return false;
-}
-
 #endif
@@ -0,0 +1,95 @@
+//@
+//@ Dklab Realplexor: Comet server which handles 1000000+ parallel browser connections
+//@ Author: Dmitry Koterov, dkLab (C)
+//@ License: GPL 2.0
+//@
+//@ 2025-* Contributor: Alexxiy
+//@ GitHub: http://github.com/alexxiy/
+//@
+//@ ATTENTION: Java-style C++ programming below. :-)
+//@
+//@ This is a line-by-line C++ rewrite of Perl prototype code with obvious speed
+//@ optimizations (like avoiding excess copies, config pre-parsing etc.).
+//@
+//@ The code is so compact (2600 lines) and so simple, that I decided not to
+//@ split it into *.hpp & *.cpp files nor create Makefiles, but place
+//@ everything into included *.h files (like Perl, Java, C# and most of other
+//@ languages do). It is not quite common for C++, but it surely simple
+//@ when a program is small (especially when it is rewritten line by line
+//@ from another language).
+//@
+//@ Also the code has global variables within the top namespace: one variable
+//@ per Storage and one CONFIG, they are like singletons.
+//@
+
+#ifndef UTILS_MPSC_RING_H
+#define UTILS_MPSC_RING_H
+
+//
+// Bounded lock-free ring of pointers: multiple producers, single consumer.
+// Each cell has a sequence number which tells whether the cell is free
+// for the producer at this position or filled for the consumer
+// (D. Vyukov's bounded queue algorithm).
+//
+template <typename T>
+class mpsc_ring
+{
+    struct Cell
+    {
+        std::atomic<size_t> seq;
+        T* data;
+    };
+
+    std::unique_ptr<Cell[]> cells;
+    size_t mask;
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) size_t tail;
+
+    mpsc_ring(const mpsc_ring&);
+    mpsc_ring& operator=(const mpsc_ring&);
+
+public:
+    // Size must be a power of 2.
+    mpsc_ring(size_t size): cells(new Cell[size]), mask(size - 1), head(0), tail(0)
+    {
+        for (size_t i = 0; i < size; i++) {
+            cells[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    // Returns false if the ring is full. May be called from any thread.
+    bool push(T* data)
+    {
+        size_t pos = head.load(std::memory_order_relaxed);
+        Cell* cell;
+        while (true) {
+            cell = &cells[pos & mask];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+            if (dif == 0) {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (dif < 0) {
+                return false;
+            } else {
+                pos = head.load(std::memory_order_relaxed);
+            }
+        }
+        cell->data = data;
+        cell->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Returns nullptr if the ring is empty. Must be called from the
+    // consumer thread only.
+    T* pop()
+    {
+        Cell* cell = &cells[tail & mask];
+        if (cell->seq.load(std::memory_order_acquire) != tail + 1) return nullptr;
+        T* data = cell->data;
+        cell->seq.store(tail + mask + 1, std::memory_order_release);
+        tail++;
+        return data;
+    }
+};
+
+#endif
@@ -0,0 +1,110 @@
+//@
+//@ Dklab Realplexor: Comet server which handles 1000000+ parallel browser connections
+//@ Author: Dmitry Koterov, dkLab (C)
+//@ License: GPL 2.0
+//@
+//@ 2025-* Contributor: Alexxiy
+//@ GitHub: http://github.com/alexxiy/
+//@
+//@ ATTENTION: Java-style C++ programming below. :-)
+//@
+//@ This is a line-by-line C++ rewrite of Perl prototype code with obvious speed
+//@ optimizations (like avoiding excess copies, config pre-parsing etc.).
+//@
+//@ The code is so compact (2600 lines) and so simple, that I decided not to
+//@ split it into *.hpp & *.cpp files nor create Makefiles, but place
+//@ everything into included *.h files (like Perl, Java, C# and most of other
+//@ languages do). It is not quite common for C++, but it surely simple
+//@ when a program is small (especially when it is rewritten line by line
+//@ from another language).
+//@
+//@ Also the code has global variables within the top namespace: one variable
+//@ per Storage and one CONFIG, they are like singletons.
+//@
+
+#ifndef UTILS_RING_H
+#define UTILS_RING_H
+
+//
+// Double-ended queue over a contiguous circular buffer of a fixed
+// capacity: once the capacity is reached, pushing and popping never
+// allocate. Elements are indexed from the front (0 is the first one).
+// Freed slots are reset to T(), so they do not hold resources.
+//
+template<typename T>
+class ring
+{
+    vector<T> _buf;
+    size_t _head;
+    size_t _size;
+
+    size_t _index(size_t i) const
+    {
+        i += _head;
+        return i < _buf.size()? i : i - _buf.size();
+    }
+
+public:
+    ring(): _head(0), _size(0) {}
+
+    size_t size() const { return _size; }
+    size_t capacity() const { return _buf.size(); }
+    bool empty() const { return !_size; }
+    bool full() const { return _size == _buf.size(); }
+
+    T& operator[](size_t i) { return _buf[_index(i)]; }
+    const T& operator[](size_t i) const { return _buf[_index(i)]; }
+    T& front() { return (*this)[0]; }
+    T& back() { return (*this)[_size - 1]; }
+    const T& front() const { return (*this)[0]; }
+    const T& back() const { return (*this)[_size - 1]; }
+
+    // Changes the capacity; the elements which do not fit are dropped
+    // from the front.
+    void reserve(size_t capacity)
+    {
+        while (_size > capacity) pop_front();
+        vector<T> buf(capacity);
+        for (size_t i = 0; i < _size; i++) buf[i] = std::move((*this)[i]);
+        _buf.swap(buf);
+        _head = 0;
+    }
+
+    // The ring must not be full.
+    void push_back(T value)
+    {
+        _buf[_index(_size)] = std::move(value);
+        _size++;
+    }
+
+    // Inserts before the i-th element, shifting the following elements
+    // to the back. The ring must not be full.
+    void insert(size_t i, T value)
+    {
+        for (size_t j = _size; j > i; j--) {
+            (*this)[j] = std::move((*this)[j - 1]);
+        }
+        (*this)[i] = std::move(value);
+        _size++;
+    }
+
+    void pop_front()
+    {
+        _buf[_head] = T();
+        _head = _index(1);
+        _size--;
+    }
+
+    void pop_back()
+    {
+        back() = T();
+        _size--;
+    }
+
+    void clear()
+    {
+        while (_size) pop_back();
+    }
+};
+
+#endif
@@ -0,0 +1,165 @@
+//@
+//@ Dklab Realplexor: Comet server which handles 1000000+ parallel browser connections
+//@ Author: Dmitry Koterov, dkLab (C)
+//@ License: GPL 2.0
+//@
+//@ 2025-* Contributor: Alexxiy
+//@ GitHub: http://github.com/alexxiy/
+//@
+//@ ATTENTION: Java-style C++ programming below. :-)
+//@
+//@ This is a line-by-line C++ rewrite of Perl prototype code with obvious speed
+//@ optimizations (like avoiding excess copies, config pre-parsing etc.).
+//@
+//@ The code is so compact (2600 lines) and so simple, that I decided not to
+//@ split it into *.hpp & *.cpp files nor create Makefiles, but place
+//@ everything into included *.h files (like Perl, Java, C# and most of other
+//@ languages do). It is not quite common for C++, but it surely simple
+//@ when a program is small (especially when it is rewritten line by line
+//@ from another language).
+//@
+//@ Also the code has global variables within the top namespace: one variable
+//@ per Storage and one CONFIG, they are like singletons.
+//@
+
+#ifndef UTILS_SLAB_H
+#define UTILS_SLAB_H
+
+//
+// Pool of same-sized memory blocks carved from big slabs: there is
+// no malloc() header per block, and blocks freed by a connection are
+// reused by the next one. Free lists are per thread (the IN thread
+// accepts its own connections). A block freed by another thread is
+// pushed to the owner's lock-free list and is reclaimed by the owner
+// when its own list is empty, so blocks do not migrate between
+// threads. Slabs are never returned to the system.
+//
+template<size_t Size>
+class slab_pool
+{
+    union block
+    {
+        block* next;
+        alignas(std::max_align_t) char data[Size];
+    };
+
+    // Per-thread pool; slab headers point to it.
+    struct owner
+    {
+        block* free;
+        std::atomic<block*> remote;
+        owner(): free(NULL), remote(NULL) {}
+    };
+
+    // Slab header; blocks follow it within the same aligned region.
+    struct slab
+    {
+        owner* pool;
+    };
+
+    static const size_t SLAB_SIZE = 65536;
+    static_assert(sizeof(block) * 16 <= SLAB_SIZE, "block is too large for a slab");
+
+    static thread_local owner* _local;
+    static std::atomic<size_t> _num_slabs;
+
+public:
+
+    static void* allocate()
+    {
+        if (!_local) _local = new owner();
+        owner* o = _local;
+        if (!o->free && o->remote.load(std::memory_order_relaxed)) {
+            o->free = o->remote.exchange(NULL, std::memory_order_acquire);
+        }
+        if (!o->free) o->free = _new_slab(o);
+        block* b = o->free;
+        o->free = b->next;
+        return b;
+    }
+
+    static void deallocate(void* p)
+    {
+        block* b = static_cast<block*>(p);
+        owner* o = _slab_of(b)->pool;
+        if (o == _local) {
+            b->next = o->free;
+            o->free = b;
+            return;
+        }
+        b->next = o->remote.load(std::memory_order_relaxed);
+        while (!o->remote.compare_exchange_weak(b->next, b, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    // Returns the number of slabs allocated by all threads.
+    static size_t get_num_slabs()
+    {
+        return _num_slabs.load(std::memory_order_relaxed);
+    }
+
+private:
+
+    static block* _new_slab(owner* o)
+    {
+        slab* s = static_cast<slab*>(::operator new(SLAB_SIZE, std::align_val_t(SLAB_SIZE)));
+        s->pool = o;
+        _num_slabs.fetch_add(1, std::memory_order_relaxed);
+        block* first = reinterpret_cast<block*>(reinterpret_cast<char*>(s) + _header_size());
+        size_t n = (SLAB_SIZE - _header_size()) / sizeof(block);
+        for (size_t i = 0; i < n; i++) {
+            first[i].next = i + 1 < n? &first[i + 1] : NULL;
+        }
+        return first;
+    }
+
+    static slab* _slab_of(block* b)
+    {
+        return reinterpret_cast<slab*>(reinterpret_cast<uintptr_t>(b) & ~(SLAB_SIZE - 1));
+    }
+
+    static size_t _header_size()
+    {
+        return (sizeof(slab) + alignof(block) - 1) / alignof(block) * alignof(block);
+    }
+};
+
+template<size_t Size>
+thread_local typename slab_pool<Size>::owner* slab_pool<Size>::_local = NULL;
+template<size_t Size>
+std::atomic<size_t> slab_pool<Size>::_num_slabs(0);
+
+// Standard allocator over slab pools (block sizes are rounded up to 16
+// bytes, so similar objects share pools), e.g. for std::allocate_shared().
+template<typename T>
+struct slab_allocator
+{
+    typedef T value_type;
+    typedef slab_pool<(sizeof(T) + 15) / 16 * 16> pool;
+
+    slab_allocator() {}
+    template<typename U> slab_allocator(const slab_allocator<U>&) {}
+
+    T* allocate(size_t n)
+    {
+        if (n != 1) return static_cast<T*>(::operator new(n * sizeof(T)));
+        return static_cast<T*>(pool::allocate());
+    }
+
+    void deallocate(T* p, size_t n)
+    {
+        if (n != 1) ::operator delete(p);
+        else pool::deallocate(p);
+    }
+
+    template<typename U> bool operator==(const slab_allocator<U>&) const { return true; }
+    template<typename U> bool operator!=(const slab_allocator<U>&) const { return false; }
+};
+
+// Creates a refcounted object and its control block in one slab block.
+template<typename T, typename... Args>
+std::shared_ptr<T> make_slab_shared(Args&&... args)
+{
+    return std::allocate_shared<T>(slab_allocator<T>(), std::forward<Args>(args)...);
+}
+
+#endif
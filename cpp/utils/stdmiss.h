@@ -50,8 +50,27 @@ vector<KT> keys(const map<KT, VT>& m)
     return result;
 }
 
-template<typename KT>
-vector<KT> sort_keys(const unordered_set<KT>& s)
+template<typename KT, typename VT>
+vector<KT> sort_keys(const unordered_map<KT, VT>& m)
+{
+    vector<KT> result;
+    for (auto& pair: m) result.push_back(pair.first);
+    sort(result.begin(), result.end());
+    return result;
+}
+
+template<typename KT, typename VT, typename H>
+vector<KT> sort_keys(const flat_map<KT, VT, H>& m)
+{
+    vector<KT> result;
+    result.reserve(m.size());
+    for (auto& pair: m) result.push_back(pair.first);
+    sort(result.begin(), result.end());
+    return result;
+}
+
+template<typename KT, typename H, typename E, typename A>
+vector<KT> sort_keys(const unordered_set<KT, H, E, A>& s)
 {
     vector<KT> result;
     for (auto e: s) result.push_back(e);
@@ -59,6 +78,23 @@ vector<KT> sort_keys(const unordered_set<KT>& s)
     return result;
 }
 
+// Returns true if sorted ranges have a common element.
+template<typename C1, typename C2>
+bool sorted_intersects(const C1& a, const C2& b)
+{
+    auto i = a.begin(), j = b.begin();
+    while (i != a.end() && j != b.end()) {
+        if (*i < *j) {
+            ++i;
+        } else if (*j < *i) {
+            ++j;
+        } else {
+            return true;
+        }
+    }
+    return false;
+}
+
 vector<string> split(const char *separators, const string& s)
 {
     vector<string> strs;
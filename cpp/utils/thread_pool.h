@@ -0,0 +1,127 @@
+//@
+//@ Dklab Realplexor: Comet server which handles 1000000+ parallel browser connections
+//@ Author: Dmitry Koterov, dkLab (C)
+//@ License: GPL 2.0
+//@
+//@ 2025-* Contributor: Alexxiy
+//@ GitHub: http://github.com/alexxiy/
+//@
+//@ ATTENTION: Java-style C++ programming below. :-)
+//@
+//@ This is a line-by-line C++ rewrite of Perl prototype code with obvious speed
+//@ optimizations (like avoiding excess copies, config pre-parsing etc.).
+//@
+//@ The code is so compact (2600 lines) and so simple, that I decided not to
+//@ split it into *.hpp & *.cpp files nor create Makefiles, but place
+//@ everything into included *.h files (like Perl, Java, C# and most of other
+//@ languages do). It is not quite common for C++, but it surely simple
+//@ when a program is small (especially when it is rewritten line by line
+//@ from another language).
+//@
+//@ Also the code has global variables within the top namespace: one variable
+//@ per Storage and one CONFIG, they are like singletons.
+//@
+
+#ifndef UTILS_THREAD_POOL_H
+#define UTILS_THREAD_POOL_H
+
+//
+// Fixed set of threads which run tasks of a parallel loop: run(n, fn)
+// calls fn(0) ... fn(n - 1) within the pool threads and the calling
+// thread and returns when all of them are finished. Tasks are taken
+// one by one, so tasks of different cost are balanced. run() must be
+// called by one thread at a time, and tasks must not throw.
+//
+class thread_pool
+{
+    typedef std::function<void(size_t)> task_fn;
+
+    vector<std::thread> _threads;
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::condition_variable _done;
+    const task_fn* _fn;
+    size_t _num_tasks;
+    std::atomic<size_t> _next;
+    size_t _running;
+    unsigned long _generation;
+    bool _stop;
+
+    thread_pool(const thread_pool&);
+    thread_pool& operator=(const thread_pool&);
+
+public:
+    explicit thread_pool(size_t size): _fn(NULL), _num_tasks(0), _next(0), _running(0), _generation(0), _stop(false)
+    {
+        // Signals are handled by the main thread only: threads inherit
+        // the mask, so it is blocked while they are started.
+        sigset_t set, old;
+        sigfillset(&set);
+        pthread_sigmask(SIG_BLOCK, &set, &old);
+        for (size_t i = 0; i < size; i++) {
+            _threads.emplace_back([this]() { _work(); });
+        }
+        pthread_sigmask(SIG_SETMASK, &old, NULL);
+    }
+
+    ~thread_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _wake.notify_all();
+        for (auto& thread: _threads) thread.join();
+    }
+
+    // Number of threads (not counting the caller of run()).
+    size_t size() const
+    {
+        return _threads.size();
+    }
+
+    void run(size_t num_tasks, const task_fn& fn)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _fn = &fn;
+            _num_tasks = num_tasks;
+            _next.store(0, std::memory_order_relaxed);
+            _running = _threads.size();
+            _generation++;
+        }
+        _wake.notify_all();
+        _take_tasks(fn, num_tasks);
+        // Every thread reports, so none of them sees the next loop
+        // before it finishes this one.
+        std::unique_lock<std::mutex> lock(_mutex);
+        _done.wait(lock, [this]() { return !_running; });
+        _fn = NULL;
+    }
+
+private:
+
+    void _take_tasks(const task_fn& fn, size_t num_tasks)
+    {
+        for (size_t i; (i = _next.fetch_add(1, std::memory_order_relaxed)) < num_tasks; ) fn(i);
+    }
+
+    void _work()
+    {
+        unsigned long generation = 0;
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (true) {
+            _wake.wait(lock, [&]() { return _stop || _generation != generation; });
+            if (_stop) return;
+            generation = _generation;
+            const task_fn& fn = *_fn;
+            size_t num_tasks = _num_tasks;
+            lock.unlock();
+            _take_tasks(fn, num_tasks);
+            lock.lock();
+            if (!--_running) _done.notify_one();
+        }
+    }
+};
+
+#endif
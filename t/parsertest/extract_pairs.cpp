@@ -0,0 +1,261 @@
+//
+// Differential test of identifier parsing (RequestParser::extract_pairs())
+// against the reference regex-based implementation it replaced, plus
+// a microbenchmark.
+//
+// Usage (see run.sh):
+//   extract_pairs           - run the differential test
+//   extract_pairs --bench   - measure the parse cost per WAIT request
+//
+
+#define main dklab_realplexor_main
+#include "../../cpp/dklab_realplexor.cpp"
+#undef main
+
+#include <chrono>
+#include <random>
+
+using namespace Realplexor;
+
+// The original implementation, kept as a reference.
+struct Reference
+{
+    static bool extract_pairs(string& data, DataPairChain& pairs, LimitIdsSet& limit_ids, Realplexor::CredPair& cred)
+    {
+        if (data.find(CONFIG.IDENTIFIER_PLUS_EQ) == data.npos) return false;
+        const char* start = data.c_str();
+        const char* p = strcasestr(start, "\nReferer:");
+        if (p) {
+            size_t pos = p - start + 1;
+            while (pos < data.length() && data[pos] != '\n') data[pos++] = ' ';
+        }
+        static regex re_login_password_id(
+            "\\b" +
+            CONFIG.IDENTIFIER_PLUS_EQ +
+            "(?:(\\w+):([^@\\s]+)@)?" +
+            "([*\\w,.:]*)" +
+            "[^*\\w,.:]"
+        );
+        boost::smatch m;
+        if (!regex_search(data, m, re_login_password_id)) return false;
+        cred.login = m[1];
+        cred.password = m[2];
+        return _split_ids(m[3], pairs, limit_ids);
+    }
+
+    static bool _split_ids(const string& ids, DataPairChain& pairs, LimitIdsSet& limit_ids)
+    {
+        static regex re_cursor_id("^(\\*?)(?:(\\d+(?:\\.\\d+)?):)?(\\w+)$");
+        cursor_t time = 0;
+        size_t pos = 0;
+        while (pos < ids.length()) {
+            size_t comma = ids.find(',', pos);
+            if (comma == ids.npos) comma = ids.length();
+            boost::smatch m;
+            if (regex_search((ids.begin() + pos), (ids.begin() + comma), m, re_cursor_id)) {
+                if (m[1].length()) {
+                    limit_ids.insert(ident_t(m[3].str()));
+                } else {
+                    if (m[2].length()) {
+                        pairs.push_back(Realplexor::DataPair(lexical_cast<cursor_t>(m[2]), ident_t(m[3].str())));
+                    } else {
+                        if (!time) time = Realplexor::Tools::time_hi_res();
+                        pairs.push_back(Realplexor::DataPair(time, ident_t(m[3].str())));
+                    }
+                }
+            }
+            pos = comma + 1;
+        }
+        return true;
+    }
+};
+
+// Parses the whole data at once.
+static bool parse_whole(string& data, DataPairChain& pairs, LimitIdsSet& limit_ids, Realplexor::CredPair& cred)
+{
+    RequestParser parser;
+    return parser.extract_pairs(data, pairs, limit_ids, cred);
+}
+
+// Parses the data received by random small chunks.
+static bool parse_chunked(string& data, DataPairChain& pairs, LimitIdsSet& limit_ids, Realplexor::CredPair& cred)
+{
+    static std::mt19937 rnd(54321);
+    RequestParser parser;
+    string received;
+    bool extracted = false;
+    for (size_t pos = 0; pos < data.length() && !extracted; ) {
+        size_t n = std::min<size_t>(1 + rnd() % 8, data.length() - pos);
+        received.append(data, pos, n);
+        pos += n;
+        extracted = parser.extract_pairs(received, pairs, limit_ids, cred);
+        if (extracted) received.append(data, pos, string::npos);
+    }
+    parser.feed(received);
+    data = received;
+    return extracted;
+}
+
+// Result of one parsing, in a comparable form.
+static string run(bool (*parser)(string&, DataPairChain&, LimitIdsSet&, Realplexor::CredPair&), string data)
+{
+    DataPairChain pairs;
+    LimitIdsSet limit_ids;
+    Realplexor::CredPair cred;
+    string result;
+    try {
+        result = parser(data, pairs, limit_ids, cred)? "ok" : "no";
+    } catch (bad_lexical_cast&) {
+        return "bad_lexical_cast";
+    }
+    result += " login=" + cred.login + " password=" + cred.password + " pairs=";
+    // Automatic cursors differ between calls: compare only their presence.
+    cursor_t now = static_cast<cursor_t>(ev::now(EV_DEFAULT) * 10000);
+    for (auto& pair: pairs) {
+        result += (pair.cursor / 10000 == now? string("AUTO") : lexical_cast<string>(pair.cursor)) + ":" + pair.id.str() + ",";
+    }
+    vector<string> limits = interned_strs(limit_ids);
+    sort(limits.begin(), limits.end());
+    result += " limit_ids=" + join(limits, ",");
+    // Referer blanking is a part of the contract too.
+    return result + " data=" + data;
+}
+
+static string random_request(std::mt19937& rnd)
+{
+    static const vector<string> tokens = {
+        "identifier=", "identifier=", "identifier=", "xidentifier=", " identifier=", "identifer=",
+        "abc", "a_1", "Z", "123", "0", "18446744073709551615", "18446744073709551616", "99999999999999999999",
+        "12.5", "1.", ".5", ":", "::", ",", ",,", "*", "**", "@", "@@", "login", "pass", "p@ss",
+        " ", "\t", "\r\n", "\n", "&", "?", "=", "-", "/", "\xC3\xA9", "\x80",
+        "\nReferer: http://x/?identifier=ref", "\nreferer: identifier=a:b@c ", "GET /?", " HTTP/1.1\r\n",
+    };
+    string s;
+    int n = rnd() % 12;
+    for (int i = 0; i < n; i++) {
+        s += tokens[rnd() % tokens.size()];
+    }
+    return s;
+}
+
+static int test()
+{
+    vector<string> cases = {
+        "",
+        "identifier=",
+        "identifier=abc",
+        "identifier=abc ",
+        "identifier=abc,def,*ghi,*jkl&",
+        "identifier=12345.23:abc,12345:def ",
+        "identifier=12345:abc,12345:def ",
+        "identifier=LOGIN:PASS@abc,10:def,*ghi ",
+        "identifier=LOGIN:PASS@abc",
+        "identifier=LOGIN:PASS@",
+        "identifier=LOGIN:PA SS@abc ",
+        "identifier=LOGIN:@abc ",
+        "identifier=:PASS@abc ",
+        "identifier=a:b:c@d ",
+        "identifier=a:b@c@d ",
+        "identifier=*12:abc ",
+        "identifier=**abc,*,,abc,",
+        "identifier=18446744073709551615:abc ",
+        "identifier=18446744073709551616:abc ",
+        "identifier=1.:abc,.1:abc,1.1.1:abc ",
+        "xidentifier=abc identifier=def ",
+        "_identifier=abc&identifier=def ",
+        "identifier=abc\nReferer: identifier=xyz\n",
+        "GET /?identifier=abc,10:def HTTP/1.1\r\nHost: x\r\nReferer: http://example.com/?identifier=zzz\r\n\r\n",
+    };
+    std::mt19937 rnd(12345);
+    for (int i = 0; i < 300000; i++) {
+        cases.push_back(random_request(rnd));
+    }
+    int failed = 0;
+    auto check = [&](const string& data, const string& expected, const string& actual) {
+        if (expected != actual && ++failed <= 10) {
+            cout << "MISMATCH for \"" << data << "\"\n  expected: " << expected << "\n  actual:   " << actual << "\n";
+        }
+    };
+    for (auto& data: cases) {
+        // The result must not depend on how the data is split.
+        string whole = run(parse_whole, data);
+        check(data, whole, run(parse_chunked, data));
+        // Reference blanks any "\nReferer:" (even in a body) and
+        // treats the end of data within credentials as IDs end, so
+        // compare only complete lines without Referer.
+        if (!ifind_first(data, "referer")) {
+            string line = data + "\n";
+            check(line, run(Reference::extract_pairs, line), run(parse_whole, line));
+        }
+    }
+    cout << cases.size() << " cases, " << failed << " mismatches\n";
+    return failed? 1 : 0;
+}
+
+static int bench()
+{
+    string request =
+        "GET /?identifier=12345678901234:chat_room_1,12345678901235:user_42,*online HTTP/1.1\r\n"
+        "Host: rpl.example.com\r\n"
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko)\r\n"
+        "Accept: */*\r\n"
+        "Referer: http://example.com/chat/?room=1\r\n"
+        "Cookie: session=0123456789abcdef\r\n"
+        "\r\n";
+    struct { const char* name; bool (*parser)(string&, DataPairChain&, LimitIdsSet&, Realplexor::CredPair&); } parsers[] = {
+        { "regex", Reference::extract_pairs },
+        { "parser", parse_whole },
+    };
+    const int n = 300000;
+    for (auto& p: parsers) {
+        auto t0 = std::chrono::steady_clock::now();
+        for (int i = 0; i < n; i++) {
+            string data = request;
+            DataPairChain pairs;
+            LimitIdsSet limit_ids;
+            Realplexor::CredPair cred;
+            p.parser(data, pairs, limit_ids, cred);
+        }
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+        printf("%-8s %.0f ns per WAIT request\n", p.name, ns / n);
+    }
+    // IN request with a large body received by 1 KB chunks: the cost
+    // per byte must not depend on the body size.
+    for (size_t size: { 20000, 200000 }) {
+        string request =
+            "POST / HTTP/1.1\r\n"
+            "Host: localhost\r\n"
+            "Content-Length: " + lexical_cast<string>(size) + "\r\n"
+            "X-Realplexor: identifier=login:password@chat_room_1,user_42\r\n"
+            "\r\n" + string(size, 'x');
+        const int n = 20;
+        auto t0 = std::chrono::steady_clock::now();
+        for (int i = 0; i < n; i++) {
+            RequestParser parser;
+            DataPairChain pairs;
+            LimitIdsSet limit_ids;
+            Realplexor::CredPair cred;
+            string data, cmd, arg;
+            size_t pos;
+            for (size_t p = 0; p < request.length(); p += 1024) {
+                data.append(request, p, 1024);
+                parser.extract_pairs(data, pairs, limit_ids, cred);
+                parser.command(data, false, cmd, arg, pos);
+            }
+        }
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+        printf("IN body of %zu bytes by 1 KB chunks: %.2f ns per byte\n", size, ns / n / request.length());
+    }
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    // Config is loaded relative to the daemon binary location.
+    string root = canonical(system_complete(argv[0])).parent_path().parent_path().parent_path().string();
+    string self = root + "/dklab_realplexor";
+    char* fake_argv[] = { (char*)self.c_str(), NULL };
+    init_argv(fake_argv);
+    CONFIG.load("", true);
+    return argc > 1 && string(argv[1]) == "--bench"? bench() : test();
+}
@@ -0,0 +1,13 @@
+#!/bin/bash
+#
+# Builds and runs the extract_pairs differential test.
+# Pass --bench to measure the parse cost per WAIT request instead.
+#
+
+cd `dirname $0`
+GCC="c++ -std=c++23"
+$GCC extract_pairs.cpp \
+    -O3 -Wfatal-errors -Wall -Werror \
+    -pthread -lcrypt -lboost_filesystem -lboost_system -lboost_regex -lev \
+    -o extract_pairs || exit $?
+./extract_pairs "$@"
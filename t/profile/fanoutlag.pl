@@ -0,0 +1,67 @@
+#!/usr/bin/perl -w
+#
+# Measures event loop pauses caused by a publish to a huge channel (see
+# FANOUT_SLICE): connects many WAIT clients listening a single ID,
+# publishes to it and reports how long the publish and the delivery
+# took and the longest loop pause ("STATS loop"). The daemon must be
+# already running, e.g.:
+#   ./dklab_realplexor `pwd`/t/profile/inbench.conf
+#
+use strict;
+use IO::Socket;
+use Time::HiRes qw(time);
+use Getopt::Long;
+
+my $clients = 10000;         # number of WAIT clients
+my $rounds = 3;              # number of publishes
+my $size = 100;              # size of published data
+my $wait_addr = "127.0.0.1:8088";
+my $in_addr = "127.0.0.1:10010";
+GetOptions(
+    "clients=i"     => \$clients,
+    "rounds=i"      => \$rounds,
+    "size=i"        => \$size,
+    "wait_addr=s"   => \$wait_addr,
+    "in_addr=s"     => \$in_addr,
+);
+
+my $data = '"' . ("x" x ($size - 2)) . '"';
+for (my $round = 1; $round <= $rounds; $round++) {
+    my @socks;
+    for (my $i = 0; $i < $clients; $i++) {
+        my $sock = IO::Socket::INET->new(PeerAddr => $wait_addr) or die "$wait_addr: $!\n";
+        print $sock "GET /?identifier=lagchannel HTTP/1.1\r\nHost: localhost\r\n\r\n";
+        push @socks, $sock;
+    }
+    # Response headers are sent when a client is registered.
+    sysread($_, my $buf, 4096) or die "Connection closed\n" for @socks;
+    in_request("STATS loop\n\n"); # resets the longest pause
+
+    my $t0 = time();
+    in_request("POST / HTTP/1.1\r\nContent-Length: " . length($data) . "\r\nX-Realplexor: identifier=lagchannel\r\n\r\n" . $data);
+    my $published = time() - $t0;
+    for my $sock (@socks) {
+        local $/;
+        my $resp = <$sock>;
+        die "Bad response: $resp\n" if $resp !~ /"lagchannel"/;
+        close($sock);
+    }
+    my $delivered = time() - $t0;
+    my ($pause) = in_request("STATS loop\n\n") =~ /max_pause: (\S+)/;
+    printf(
+        "%d clients: published in %.1f ms, delivered in %.1f ms, longest loop pause %.1f ms\n",
+        $clients, $published * 1000, $delivered * 1000, $pause * 1000
+    );
+}
+
+# Sends a request to IN line and returns the response body.
+sub in_request {
+    my ($req) = @_;
+    my $sock = IO::Socket::INET->new(PeerAddr => $in_addr) or die "$in_addr: $!\n";
+    print $sock $req;
+    shutdown($sock, 1);
+    local $/;
+    my $resp = <$sock>;
+    $resp =~ s/^.*?\r\n\r\n//s;
+    return $resp;
+}
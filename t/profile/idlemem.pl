@@ -0,0 +1,54 @@
+#!/usr/bin/perl -w
+#
+# Measures resident memory per idle WAIT connection: opens N clients
+# which send a browser-like request and keep waiting for data, then
+# compares RSS of the daemon before and after. The daemon must be
+# already running, e.g.:
+#   ./dklab_realplexor `pwd`/t/profile/inbench.conf
+#
+use strict;
+use IO::Socket;
+use Getopt::Long;
+
+my $num = 10000;             # number of idle connections
+my $wait_addr = "127.0.0.1:8088";
+my $pid = undef;             # daemon process (by default the newest dklab_realplexor)
+GetOptions(
+    "num=i"       => \$num,
+    "wait_addr=s" => \$wait_addr,
+    "pid=i"       => \$pid,
+);
+if (!$pid) {
+    chomp($pid = `pgrep -n -f '^[^ ]*dklab_realplexor( |\$)'`);
+    die "Cannot find dklab_realplexor process, use --pid\n" if !$pid;
+}
+
+my $before = rss();
+my @socks;
+for (my $i = 0; $i < $num; $i++) {
+    my $sock = IO::Socket::INET->new(PeerAddr => $wait_addr) or die "$wait_addr: $!\n";
+    print $sock
+        "GET /?identifier=" . (10000 + $i) . ":idle_channel_$i&ncrnd=" . time() . " HTTP/1.1\r\n" .
+        "Host: rpl.example.com\r\n" .
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0 Safari/537.36\r\n" .
+        "Accept: */*\r\n" .
+        "Accept-Language: en-US,en;q=0.9\r\n" .
+        "Referer: http://example.com/chat/?room=$i\r\n" .
+        "Cookie: session=0123456789abcdef0123456789abcdef\r\n" .
+        "\r\n";
+    $sock->flush();
+    push @socks, $sock;
+}
+sleep(2);
+my $after = rss();
+printf("%d idle connections: RSS %.1f MB -> %.1f MB, %d bytes per connection\n",
+    $num, $before / 1024, $after / 1024, ($after - $before) * 1024 / $num);
+
+# Returns RSS of the daemon in KB.
+sub rss {
+    open(my $f, "<", "/proc/$pid/status") or die "Cannot read /proc/$pid/status: $!\n";
+    while (<$f>) {
+        return $1 if /^VmRSS:\s+(\d+)/;
+    }
+    die "No VmRSS for $pid\n";
+}
@@ -0,0 +1,96 @@
+#!/usr/bin/perl -w
+#
+# Measures IN line publishing throughput: HTTP request per connection,
+# pipelined HTTP keep-alive requests and pipelined binary frames
+# (IN_BINARY_ADDR). The daemon must be already running, e.g.:
+#   ./dklab_realplexor `pwd`/t/profile/inbench.conf
+#
+use strict;
+use IO::Socket;
+use Time::HiRes qw(time);
+use Getopt::Long;
+
+my $req = 20000;             # number of publishes per mode
+my $ids = 3;                 # number of IDs per publish
+my $size = 100;              # size of published data
+my $http_addr = "127.0.0.1:10010";
+my $binary_addr = "127.0.0.1:10012";
+GetOptions(
+    "req=i"         => \$req,
+    "ids=i"         => \$ids,
+    "size=i"        => \$size,
+    "http_addr=s"   => \$http_addr,
+    "binary_addr=s" => \$binary_addr,
+);
+
+my $data = '"' . ("x" x ($size - 2)) . '"';
+my @ids = map { "benchid$_" } (1 .. $ids);
+
+# HTTP request per connection (as PHP API does).
+bench("http", sub {
+    my $body = $data;
+    for (my $i = 0; $i < $req; $i++) {
+        my $sock = IO::Socket::INET->new(PeerAddr => $http_addr) or die "$http_addr: $!\n";
+        print $sock "POST / HTTP/1.1\r\nContent-Length: " . length($body) . "\r\nX-Realplexor: identifier=" . join(",", @ids) . "\r\n\r\n" . $body;
+        shutdown($sock, 1);
+        local $/;
+        my $resp = <$sock>;
+        die "Bad response: $resp\n" if $resp !~ m{^HTTP/1.\d 200};
+    }
+});
+
+# Pipelined HTTP keep-alive requests.
+bench("http keep-alive", sub {
+    my $one = "POST / HTTP/1.1\r\nConnection: keep-alive\r\nContent-Length: " . length($data) . "\r\nX-Realplexor: identifier=" . join(",", @ids) . "\r\n\r\n" . $data;
+    pipelined($http_addr, $one, sub {
+        my ($buf) = @_;
+        return undef if $$buf !~ m{^(HTTP/1.1 200[^\n]*\n.*?Content-Length: (\d+)\r\n\r\n)}s;
+        return undef if length($$buf) < length($1) + $2;
+        return length($1) + $2;
+    });
+});
+
+# Pipelined binary frames.
+bench("binary", sub {
+    my $payload = pack("Q>n", 0, scalar(@ids)) . join("", map { pack("n/a*", $_) } @ids) . pack("n", 0) . pack("N/a*", $data);
+    my $one = pack("NC", length($payload), ord('P')) . $payload;
+    pipelined($binary_addr, $one, sub {
+        my ($buf) = @_;
+        return undef if length($$buf) < 5;
+        my ($len, $status) = unpack("NC", $$buf);
+        die "Error response: " . substr($$buf, 5, $len) . "\n" if $status;
+        return undef if length($$buf) < 5 + $len;
+        return 5 + $len;
+    });
+});
+
+# Writes $req copies of the request to one connection and reads
+# the same number of responses; $cut returns the length of the first
+# complete response in the buffer (or undef).
+sub pipelined {
+    my ($addr, $one, $cut) = @_;
+    my $sock = IO::Socket::INET->new(PeerAddr => $addr) or die "$addr: $!\n";
+    my $batch = 1000;
+    my ($sent, $received, $buf) = (0, 0, "");
+    while ($received < $req) {
+        if ($sent < $req && $sent - $received < $batch * 2) {
+            my $n = $req - $sent < $batch? $req - $sent : $batch;
+            print $sock $one x $n;
+            $sent += $n;
+        }
+        sysread($sock, $buf, 65536, length($buf)) or die "Connection closed\n";
+        while (defined(my $len = $cut->(\$buf))) {
+            substr($buf, 0, $len) = "";
+            $received++;
+        }
+    }
+    close($sock);
+}
+
+sub bench {
+    my ($name, $sub) = @_;
+    my $t0 = time();
+    $sub->();
+    my $dt = time() - $t0;
+    printf("%-16s %d publishes in %.2f s: %d publishes/s\n", $name, $req, $dt, $req / $dt);
+}
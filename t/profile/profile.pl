@@ -16,6 +16,8 @@ my $ids_match = undef;       # how many ids from listened must match a non-empty
 my $recv_pack_size = undef;
 my $concur = 1;
 my $req = undef;
+my $bin = 0;                 # run C++ binary instead of Perl version
+my $wait_workers = 1;        # number of WAIT processes (C++ binary only)
 GetOptions(
     "profile"           => \$profile,
     "filled_channels=i" => \$filled_channels,
@@ -25,6 +27,8 @@ GetOptions(
     "recv_pack_size=i"  => \$recv_pack_size,
     "concur=i"          => \$concur,
     "req=i"             => \$req,
+    "bin"               => \$bin,
+    "wait_workers=i"    => \$wait_workers,
 );
 $req ||= $profile? 1000 : 2000;
 $ids_match = $ids_listen if !defined $ids_match;
@@ -49,7 +53,14 @@ if (!fork()) {
         $ENV{PERL5OPT} = '-d:NYTProf';
         $ENV{NYTPROF} = "sigexit=int,hup:start=no:addpid=1:file=$dir/nytprof.out";
     }
-    exec "perl dklab_realplexor.pl $cwd/dklab_realplexor.conf -p $dir/dklab_realplexor.pid";
+    my $conf = "$cwd/dklab_realplexor.conf";
+    if ($wait_workers > 1) {
+        $conf = "$dir/dklab_realplexor.conf";
+        open(my $f, ">", $conf);
+        print $f qq{do "$cwd/dklab_realplexor.conf";\n\$CONFIG{WAIT_WORKERS} = $wait_workers;\nreturn 1;\n};
+        close($f);
+    }
+    exec(($bin? "./dklab_realplexor" : "perl dklab_realplexor.pl") . " $conf -p $dir/dklab_realplexor.pid");
 }
 sleep 1;
 
@@ -80,6 +91,7 @@ while (-s $log != $log_size) {
     $log_size = -s $log;
     sleep(1);
 }
+print_rss("after filling channels");
 
 
 # Start load testing.
@@ -89,6 +101,7 @@ for (my $i = 0; $i < 1; $i++) {
     my $cmd = "ab -R $filled_channels -c $concur -n $req 'http://127.0.0.1:8088/?identifier=$idsRecv'";
     print "# $cmd\n";
     if (0 == system($cmd)) {
+        print_rss("after load");
         killchild();
         sleep 2;
     }
@@ -101,6 +114,31 @@ if ($profile) {
     system("nytprofhtml -f `ls -S *.out* | head -n 1`"); # sort by file size reverse
 }
 
+# Prints resident memory of the daemon (the watchdog and its worker).
+sub print_rss {
+    my ($when) = @_;
+    chomp(my $pid = `cat $dir/dklab_realplexor.pid`);
+    my $rss = 0;
+    $rss += $_ for grep { /\d/ } split /\s+/, `ps -o rss= -p $pid --ppid $pid`;
+    printf("# RSS %s: %.1f MB\n", $when, $rss / 1024);
+    print_arena_stats() if $bin;
+}
+
+# Prints payload arena statistics of the C++ daemon (to see how much
+# of RSS is taken by message data and how fragmented it is).
+sub print_arena_stats {
+    my $sock = IO::Socket::INET->new(
+        PeerAddr => '127.0.0.1',
+        PeerPort => '10010'
+    ) or return;
+    print $sock "STATS arena\n\n";
+    shutdown($sock, 1);
+    local $/;
+    my $resp = <$sock>;
+    $resp =~ s/^.*?\r\n\r\n//s;
+    print map { "#   $_\n" } split /\n/, $resp;
+}
+
 # Kills realplexor daemon.
 sub killchild {
     kill(2, `cat $dir/dklab_realplexor.pid`)? print("Killed!\n") : print("Not killed!\n");
@@ -0,0 +1,52 @@
+--TEST--
+dklab_realplexor: pipelined keep-alive publishes get ordered responses and increasing cursors
+
+--FILE--
+<?php
+require dirname(__FILE__) . '/init.php';
+
+send_wait("identifier=abc");
+$responses = send_in_pipelined(array(
+    array("identifier=abc", '"aaa"'),
+    array("identifier=10:abc", '"bbb"'),
+    array("identifier=20:abc,30:def", '"ccc"'),
+));
+foreach ($responses as $resp) {
+    echo add_prefix(trim($resp), 'IN ==>') . "\n";
+}
+recv_wait();
+
+// More publishes than cursors within one loop iteration used to fit.
+$requests = array();
+for ($i = 0; $i < 1500; $i++) {
+    $requests[] = array("identifier=def", '"' . $i . '"');
+}
+$cursors = array();
+foreach (send_in_pipelined($requests) as $resp) {
+    if (preg_match('/^def (\d+)\s*$/', $resp, $m)) $cursors[] = $m[1];
+}
+echo count($cursors) . " responses, cursors increase: " . (cursors_increase($cursors)? "yes" : "no") . "\n";
+
+?>
+--EXPECTF--
+WA <-- identifier=abc
+IN ==> abc %d
+IN ==> abc 10
+IN ==> abc 20
+IN ==> def 30
+WA --> HTTP/1.1 200 OK
+WA --> Connection: close
+WA --> Cache-Control: no-store, no-cache, must-revalidate
+WA --> Expires: ***
+WA --> Content-Type: text/javascript; charset=utf-8
+WA -->
+WA -->
+WA --> [
+WA -->   {
+WA -->     "ids": { "abc": <cursor> },
+WA -->     "data": "aaa"
+WA -->   }
+WA --> ]
+WA :: Disconnecting.
+1500 responses, cursors increase: yes
+#   [pairs_by_fhs=0 data_to_send=2 connected_fhs=0 online_timers=1 cleanup_timers=2 events=*]
@@ -0,0 +1,52 @@
+--TEST--
+dklab_realplexor: request with Content-Length is ignored if the client disconnects before its body is received
+
+--FILE--
+<?php
+require dirname(__FILE__) . '/init.php';
+
+send_wait("identifier=abc");
+send_in(null, '
+    POST / HTTP/1.1
+    Connection: keep-alive
+    Content-Length: 100
+    X-Realplexor: identifier=abc
+
+    "aaa"
+');
+send_in("identifier=abc", "bbb");
+recv_wait();
+
+?>
+--EXPECTF--
+WA <-- identifier=abc
+IN <== POST / HTTP/1.1
+IN <== Connection: keep-alive
+IN <== Content-Length: 100
+IN <== X-Realplexor: identifier=abc
+IN <==
+IN <== "aaa"
+IN ==>
+IN <== X-Realplexor: identifier=abc
+IN <==
+IN <== "bbb"
+IN ==> HTTP/1.0 200 OK
+IN ==> Content-Type: text/plain
+IN ==> Content-Length: %d
+IN ==>
+IN ==> abc %d
+WA --> HTTP/1.1 200 OK
+WA --> Connection: close
+WA --> Cache-Control: no-store, no-cache, must-revalidate
+WA --> Expires: ***
+WA --> Content-Type: text/javascript; charset=utf-8
+WA -->
+WA -->
+WA --> [
+WA -->   {
+WA -->     "ids": { "abc": <cursor> },
+WA -->     "data": "bbb"
+WA -->   }
+WA --> ]
+WA :: Disconnecting.
+#   [pairs_by_fhs=0 data_to_send=1 connected_fhs=0 online_timers=1 cleanup_timers=1 events=*]
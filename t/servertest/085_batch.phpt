@@ -0,0 +1,59 @@
+--TEST--
+dklab_realplexor: batch publish returns a line of cursors per record
+
+--FILE--
+<?php
+require dirname(__FILE__) . '/init.php';
+
+send_wait("identifier=abc");
+send_in(null, '
+    BATCH
+    abc 5
+    "aaa"
+    10:abc,20:def 5
+    "bbb"
+');
+recv_wait();
+
+// More records than cursors within one loop iteration used to fit.
+$batch = "BATCH\n";
+for ($i = 0; $i < 1500; $i++) {
+    $batch .= "def " . strlen("\"$i\"") . "\n\"$i\"\n";
+}
+$cursors = array();
+foreach (send_in_pipelined(array(array(null, $batch))) as $resp) {
+    preg_match_all('/^(\d+):def$/m', $resp, $m);
+    $cursors = $m[1];
+}
+echo count($cursors) . " records, cursors increase: " . (cursors_increase($cursors)? "yes" : "no") . "\n";
+
+?>
+--EXPECTF--
+WA <-- identifier=abc
+IN <== BATCH
+IN <== abc 5
+IN <== "aaa"
+IN <== 10:abc,20:def 5
+IN <== "bbb"
+IN ==> HTTP/1.0 200 OK
+IN ==> Content-Type: text/plain
+IN ==> Content-Length: %d
+IN ==>
+IN ==> %d:abc
+IN ==> 10:abc,20:def
+WA --> HTTP/1.1 200 OK
+WA --> Connection: close
+WA --> Cache-Control: no-store, no-cache, must-revalidate
+WA --> Expires: ***
+WA --> Content-Type: text/javascript; charset=utf-8
+WA -->
+WA -->
+WA --> [
+WA -->   {
+WA -->     "ids": { "abc": <cursor> },
+WA -->     "data": "aaa"
+WA -->   }
+WA --> ]
+WA :: Disconnecting.
+1500 records, cursors increase: yes
+#   [pairs_by_fhs=0 data_to_send=2 connected_fhs=0 online_timers=1 cleanup_timers=2 events=*]
@@ -0,0 +1,45 @@
+--TEST--
+dklab_realplexor: clients of all WAIT workers are online and receive data
+
+--FILE--
+<?php
+$REALPLEXOR_CONF = "wait_workers.conf";
+require dirname(__FILE__) . '/init.php';
+
+// The kernel spreads connections among processes.
+$socks = array();
+for ($i = 0; $i < 6; $i++) {
+    $socks[] = fsockopen("127.0.0.1", 8088);
+    fwrite($socks[$i], "identifier=abc\n");
+    expect('/WAIT.*registered/');
+}
+// Wait for workers to report their connections.
+usleep(300000);
+send_in(null, "online");
+
+send_in("identifier=abc", "aaa");
+$received = 0;
+foreach ($socks as $sock) {
+    if (strpos(stream_get_contents($sock), '"data": "aaa"') !== false) $received++;
+    fclose($sock);
+}
+echo "$received of " . count($socks) . " clients received data\n";
+
+?>
+--EXPECTF--
+IN <== online
+IN ==> HTTP/1.0 200 OK
+IN ==> Content-Type: text/plain
+IN ==> Content-Length: 6
+IN ==>
+IN ==> abc 6
+IN <== X-Realplexor: identifier=abc
+IN <==
+IN <== "aaa"
+IN ==> HTTP/1.0 200 OK
+IN ==> Content-Type: text/plain
+IN ==> Content-Length: %d
+IN ==>
+IN ==> abc %d
+6 of 6 clients received data
+#   [pairs_by_fhs=%d data_to_send=%d connected_fhs=%d online_timers=%d cleanup_timers=%d events=*]
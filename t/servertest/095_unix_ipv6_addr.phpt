@@ -0,0 +1,69 @@
+--TEST--
+dklab_realplexor: listen Unix domain socket and IPv6 addresses
+
+--FILE--
+<?php
+$REALPLEXOR_CONF = "unix_ipv6_addr.conf";
+require dirname(__FILE__) . '/init.php';
+
+$WAIT_ADDR = "tcp://[::1]:8089";
+send_wait("identifier=abc");
+$IN_ADDR = "unix:///tmp/dklab_realplexor_test.sock";
+send_in("identifier=abc", "aaa");
+recv_wait();
+
+$WAIT_ADDR = "tcp://127.0.0.1:8088";
+send_wait("identifier=def");
+$IN_ADDR = "tcp://[::1]:10011";
+send_in("identifier=def", "bbb");
+recv_wait();
+
+?>
+--EXPECTF--
+WA <-- identifier=abc
+IN <== X-Realplexor: identifier=abc
+IN <==
+IN <== "aaa"
+IN ==> HTTP/1.0 200 OK
+IN ==> Content-Type: text/plain
+IN ==> Content-Length: %d
+IN ==>
+IN ==> abc %d
+WA --> HTTP/1.1 200 OK
+WA --> Connection: close
+WA --> Cache-Control: no-store, no-cache, must-revalidate
+WA --> Expires: ***
+WA --> Content-Type: text/javascript; charset=utf-8
+WA -->
+WA -->
+WA --> [
+WA -->   {
+WA -->     "ids": { "abc": <cursor> },
+WA -->     "data": "aaa"
+WA -->   }
+WA --> ]
+WA :: Disconnecting.
+WA <-- identifier=def
+IN <== X-Realplexor: identifier=def
+IN <==
+IN <== "bbb"
+IN ==> HTTP/1.0 200 OK
+IN ==> Content-Type: text/plain
+IN ==> Content-Length: %d
+IN ==>
+IN ==> def %d
+WA --> HTTP/1.1 200 OK
+WA --> Connection: close
+WA --> Cache-Control: no-store, no-cache, must-revalidate
+WA --> Expires: ***
+WA --> Content-Type: text/javascript; charset=utf-8
+WA -->
+WA -->
+WA --> [
+WA -->   {
+WA -->     "ids": { "def": <cursor> },
+WA -->     "data": "bbb"
+WA -->   }
+WA --> ]
+WA :: Disconnecting.
+#   [pairs_by_fhs=0 data_to_send=2 connected_fhs=0 online_timers=2 cleanup_timers=2 events=*]
@@ -0,0 +1,72 @@
+--TEST--
+dklab_realplexor: binary publishing protocol
+
+--FILE--
+<?php
+$REALPLEXOR_CONF = "binary_in.conf";
+require dirname(__FILE__) . '/init.php';
+
+function bin_str($s)
+{
+    return pack("n", strlen($s)) . $s;
+}
+
+function bin_frame($type, $payload)
+{
+    return pack("NC", strlen($payload), ord($type)) . $payload;
+}
+
+function bin_publish($ids, $data, $cursor = 0)
+{
+    return bin_frame("P",
+        pack("Jn", $cursor, count($ids)) . join("", array_map('bin_str', $ids)) .
+        pack("n", 0) .
+        pack("N", strlen($data)) . $data
+    );
+}
+
+function bin_recv($sock)
+{
+    $head = stream_get_contents($sock, 5);
+    if (strlen($head) < 5) return "BI ==> (closed)";
+    $frame = unpack("Nlength/Cstatus", $head);
+    $text = $frame['length']? stream_get_contents($sock, $frame['length']) : "";
+    return add_prefix("[" . $frame['status'] . "] " . trim($text), 'BI ==>');
+}
+
+send_wait("identifier=abc");
+$sock = stream_socket_client("tcp://127.0.0.1:10012");
+fwrite($sock, bin_publish(array("abc", "def"), '"aaa"') . bin_publish(array("abc"), '"bbb"', 5));
+echo bin_recv($sock) . "\n";
+echo bin_recv($sock) . "\n";
+recv_wait();
+
+// Wrong login: error response, then the connection is closed.
+fwrite($sock, bin_frame("L", bin_str("unk") . bin_str("pass")));
+echo bin_recv($sock) . "\n";
+echo bin_recv($sock) . "\n";
+fclose($sock);
+
+?>
+--EXPECTF--
+WA <-- identifier=abc
+BI ==> [0] abc %d
+BI ==> def %d
+BI ==> [0] abc 5
+WA --> HTTP/1.1 200 OK
+WA --> Connection: close
+WA --> Cache-Control: no-store, no-cache, must-revalidate
+WA --> Expires: ***
+WA --> Content-Type: text/javascript; charset=utf-8
+WA -->
+WA -->
+WA --> [
+WA -->   {
+WA -->     "ids": { "abc": <cursor> },
+WA -->     "data": "aaa"
+WA -->   }
+WA --> ]
+WA :: Disconnecting.
+BI ==> [1] unknown login: unk
+BI ==> (closed)
+#   [pairs_by_fhs=0 data_to_send=2 connected_fhs=0 online_timers=1 cleanup_timers=2 events=*]
@@ -24,6 +24,10 @@ $DEBUG = !!getenv('debug') || (@$_SERVER['argv'][1] == "-v");
 // Do not run the daemon?
 $NORUN = !!@$NORUN;
 
+// Addresses of IN and WAIT lines used by send_in() and send_wait().
+if (!isset($IN_ADDR)) $IN_ADDR = "tcp://127.0.0.1:10010";
+if (!isset($WAIT_ADDR)) $WAIT_ADDR = "tcp://127.0.0.1:8088";
+
 
 // Start the realplexor.
 if (empty($NORUN)) {
@@ -127,7 +131,7 @@ function expect($re)
 
 function send_in($ids, $data, $noWaitResponse = false)
 {
-    global $IN_SOCK;
+    global $IN_SOCK, $IN_ADDR;
     $data = trim(preg_replace('/^[ \t]+/m', '', $data));
     if ($ids !== null) {
         $out = "X-Realplexor: $ids\r\n\r\n";
@@ -136,7 +140,7 @@ function send_in($ids, $data, $noWaitResponse = false)
         $out = $data;
     }
     echo add_prefix($out, 'IN <==') . "\n";
-    $IN_SOCK = fsockopen("127.0.0.1", 10010);
+    $IN_SOCK = stream_socket_client($IN_ADDR);
     fwrite($IN_SOCK, $out);
     if (!$noWaitResponse) {
         // Do not shutdown writing to the socket, else realplexor
@@ -184,12 +188,56 @@ function disconnect_in()
     expect('/IN.*closed/');
 }
 
+// Sends keep-alive requests to IN line in one write (pipelining) and
+// returns bodies of their responses. Each request is a pair
+// array(identifier, body); identifier may be null for commands.
+function send_in_pipelined($requests)
+{
+    $out = "";
+    foreach ($requests as $req) {
+        list ($ids, $body) = $req;
+        $out .=
+            "POST / HTTP/1.1\r\n" .
+            "Connection: keep-alive\r\n" .
+            "Content-Length: " . strlen($body) . "\r\n" .
+            ($ids !== null? "X-Realplexor: $ids\r\n" : "") . "\r\n" .
+            $body;
+    }
+    $sock = fsockopen("127.0.0.1", 10010);
+    fwrite($sock, $out);
+    $responses = array();
+    $buf = "";
+    while (count($responses) < count($requests) && !feof($sock)) {
+        $buf .= fread($sock, 65536);
+        while (preg_match('/^(.*?)\r\n\r\n/s', $buf, $m) && preg_match('/Content-Length: (\d+)/', $m[1], $len)) {
+            if (strlen($buf) < strlen($m[0]) + $len[1]) break;
+            $responses[] = substr($buf, strlen($m[0]), $len[1]);
+            $buf = substr($buf, strlen($m[0]) + $len[1]);
+        }
+    }
+    fclose($sock);
+    return $responses;
+}
+
+// Returns true if each cursor (a decimal string) is greater than
+// the previous one.
+function cursors_increase($cursors)
+{
+    $prev = "";
+    foreach ($cursors as $cursor) {
+        $cursor = str_pad($cursor, 20, "0", STR_PAD_LEFT);
+        if (strcmp($cursor, $prev) <= 0) return false;
+        $prev = $cursor;
+    }
+    return true;
+}
+
 function send_wait($data, $nowait = false)
 {
-    global $WAIT_SOCK;
+    global $WAIT_SOCK, $WAIT_ADDR;
     $data = trim(preg_replace('/^[ \t]+/m', '', $data));
     echo add_prefix($data, 'WA <--') . "\n";
-    $WAIT_SOCK = fsockopen("127.0.0.1", 8088);
+    $WAIT_SOCK = stream_socket_client($WAIT_ADDR);
     fwrite($WAIT_SOCK, "$data\n");
     fflush($WAIT_SOCK);
     if (!$nowait) expect('/WAIT.*registered|WAIT.*marker received/');
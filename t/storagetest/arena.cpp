@@ -0,0 +1,201 @@
+//
+// Randomized test of payload_arena (including blocks freed by another
+// thread) and of slab_pool, plus a benchmark against malloc() on
+// rotating data queues.
+//
+// Usage (see run.sh):
+//   arena           - run the test
+//   arena --bench   - measure allocation cost and memory left after load
+//
+
+#define main dklab_realplexor_main
+#include "../../cpp/dklab_realplexor.cpp"
+#undef main
+
+#include <chrono>
+#include <random>
+#include <malloc.h>
+
+using namespace Realplexor;
+
+// Returns a number from arena statistics line, e.g. "bytes mapped".
+static size_t stat(const string& name)
+{
+    string stats = payload_arena::get_stats();
+    size_t pos = stats.find(" " + name);
+    if (pos == string::npos) return 0;
+    size_t start = stats.find_last_of(" :", pos - 1) + 1;
+    return lexical_cast<size_t>(stats.substr(start, pos - start));
+}
+
+// Resident memory of the process in bytes.
+static size_t rss()
+{
+    std::ifstream f("/proc/self/statm");
+    size_t size = 0, resident = 0;
+    f >> size >> resident;
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+// Random payload size: mostly small messages, sometimes large ones.
+static size_t random_size(std::mt19937& rnd)
+{
+    return rnd() % 10? 1 + rnd() % 2000 : 1 + rnd() % 30000;
+}
+
+static int test()
+{
+    int failed = 0;
+    auto check = [&](bool ok, const string& what) {
+        if (!ok && ++failed <= 10) cout << "FAILED: " << what << "\n";
+    };
+    std::mt19937 rnd(12345);
+    // Static objects (e.g. constant parts of responses) are allocated
+    // before the test.
+    size_t requested = stat("requested");
+
+    // Blocks do not overlap: each one keeps its own filler.
+    struct Block { char* p; size_t n; char c; };
+    vector<Block> blocks;
+    auto verify = [&](const Block& b) {
+        bool ok = true;
+        for (size_t i = 0; i < b.n; i++) ok = ok && b.p[i] == b.c;
+        check(ok, "block of " + lexical_cast<string>(b.n) + " bytes is intact");
+    };
+    for (int i = 0; i < 200000; i++) {
+        if (blocks.size() && rnd() % 2) {
+            size_t j = rnd() % blocks.size();
+            verify(blocks[j]);
+            payload_arena::deallocate(blocks[j].p, blocks[j].n);
+            blocks[j] = blocks.back();
+            blocks.pop_back();
+        } else {
+            Block b = { NULL, random_size(rnd), (char)rnd() };
+            b.p = static_cast<char*>(payload_arena::allocate(b.n));
+            memset(b.p, b.c, b.n);
+            blocks.push_back(b);
+        }
+    }
+    for (auto& b: blocks) verify(b);
+
+    // Blocks freed by another thread are reclaimed by the owner, then
+    // all slabs but one per class are unmapped.
+    std::thread([&]() {
+        for (auto& b: blocks) payload_arena::deallocate(b.p, b.n);
+    }).join();
+    blocks.clear();
+    payload_arena::deallocate(payload_arena::allocate(100), 100);
+    check(stat("requested") == requested, "all blocks are reclaimed:\n" + payload_arena::get_stats());
+    check(stat("bytes mapped") <= 19 * payload_arena::SLAB_SIZE, "empty slabs are unmapped:\n" + payload_arena::get_stats());
+    check(payload_arena::get_stats().find("large: 0 blocks") != string::npos, "large blocks are freed:\n" + payload_arena::get_stats());
+
+    // Arenas of exited threads are adopted by new threads (e.g. when
+    // the encoding pool is recreated), so they do not pile up.
+    size_t mapped = stat("bytes mapped");
+    for (int i = 0; i < 20; i++) {
+        void* p = NULL;
+        std::thread([&]() { p = payload_arena::allocate(100); }).join();
+        payload_arena::deallocate(p, 100);
+    }
+    std::thread([]() { payload_arena::deallocate(payload_arena::allocate(100), 100); }).join();
+    check(stat("requested") == requested, "blocks of exited threads are reclaimed:\n" + payload_arena::get_stats());
+    check(stat("bytes mapped") <= mapped + payload_arena::SLAB_SIZE, "arenas of exited threads are reused:\n" + payload_arena::get_stats());
+
+    // Payload objects.
+    {
+        DataRef rdata = make_local<RefString>(string("0123456789"), 2, 3);
+        check(rdata->str() == "234", "RefString substring");
+        LimitIdsRef limit_ids = make_local<RefLimitIdsSet>();
+        limit_ids->insert(ident_t("abc"));
+        check(limit_ids->count(ident_t("abc")) == 1, "RefLimitIdsSet");
+        check(stat("requested") > requested, "payload objects are within the arena");
+    }
+    payload_arena::deallocate(payload_arena::allocate(100), 100);
+    check(stat("requested") == requested, "payload objects are freed");
+
+    // Slab blocks allocated by a thread and freed by another one go
+    // back to the allocating thread (as connections accepted by the IN
+    // thread and closed by the main loop), so its slabs do not grow.
+    typedef slab_pool<256> pool;
+    std::atomic<int> round(0);
+    vector<void*> handed;
+    size_t slabs_after_first = 0;
+    std::thread owner([&]() {
+        for (int i = 0; i < 20; i++) {
+            while (round.load() != i * 2) std::this_thread::yield();
+            for (int j = 0; j < 5000; j++) handed.push_back(pool::allocate());
+            if (!i) slabs_after_first = pool::get_num_slabs();
+            round.store(i * 2 + 1);
+        }
+    });
+    for (int i = 0; i < 20; i++) {
+        while (round.load() != i * 2 + 1) std::this_thread::yield();
+        for (void* p: handed) pool::deallocate(p);
+        handed.clear();
+        round.store(i * 2 + 2);
+    }
+    owner.join();
+    check(pool::get_num_slabs() <= slabs_after_first * 2, "slab blocks freed by another thread are reused: " + lexical_cast<string>(pool::get_num_slabs()) + " slabs");
+
+    cout << "arena: " << failed << " failures\n";
+    return failed? 1 : 0;
+}
+
+// Publishes n messages of random sizes to rotating queues of 30 items
+// and empties the queues; returns ns per message.
+template<class Alloc, class Free>
+static double bench_queues(Alloc alloc, Free free, int n)
+{
+    std::mt19937 rnd(54321);
+    const size_t num_ids = 2000, max_num = 30;
+    vector<ring<std::pair<void*, size_t>>> queues(num_ids);
+    for (auto& q: queues) q.reserve(max_num);
+    auto t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < n; i++) {
+        auto& q = queues[rnd() % num_ids];
+        if (q.full()) {
+            free(q.front().first, q.front().second);
+            q.pop_front();
+        }
+        size_t size = random_size(rnd);
+        void* p = alloc(size);
+        memset(p, 'x', size);
+        q.push_back(std::make_pair(p, size));
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+    // Most queues expire; some messages stay.
+    for (size_t i = 0; i < num_ids; i++) {
+        for (auto& q = queues[i]; q.size() > (i % 100? 0 : 1); q.pop_front()) {
+            free(q.front().first, q.front().second);
+        }
+    }
+    return ns / n;
+}
+
+static int bench()
+{
+    const int n = 3000000;
+    size_t rss0 = rss();
+    double ns = bench_queues(
+        [](size_t n) { return ::operator new(n); },
+        [](void* p, size_t n) { ::operator delete(p); },
+        n
+    );
+    malloc_trim(0);
+    printf("%-8s %.1f ns per message, %.1f MB of RSS left\n", "malloc", ns, (double)(rss() - rss0) / 1048576);
+    rss0 = rss();
+    ns = bench_queues(
+        [](size_t n) { return payload_arena::allocate(n); },
+        [](void* p, size_t n) { payload_arena::deallocate(p, n); },
+        n
+    );
+    malloc_trim(0);
+    printf("%-8s %.1f ns per message, %.1f MB of RSS left\n", "arena", ns, (double)(rss() - rss0) / 1048576);
+    cout << payload_arena::get_stats();
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    return argc > 1 && string(argv[1]) == "--bench"? bench() : test();
+}
@@ -0,0 +1,133 @@
+//
+// Randomized test of Storage::DataToSend queues against the original
+// list-based implementation, plus a benchmark of publishing.
+//
+// Usage (see run.sh):
+//   data_to_send           - run the test
+//   data_to_send --bench   - measure the cost of adding data to an ID
+//
+
+#define main dklab_realplexor_main
+#include "../../cpp/dklab_realplexor.cpp"
+#undef main
+
+#include <chrono>
+#include <random>
+
+using namespace Realplexor;
+
+// The original implementation, kept as a reference: a list sorted by
+// cursor (the newest first) cut to max_num items before sending.
+struct Reference
+{
+    flat_map<ident_t, list<DataChunk>> storage;
+
+    void add_dataref_to_id(const ident_t& id, cursor_t cursor, const DataRef& rdata, const LimitIdsRef& rlimit_ids)
+    {
+        auto& lst = storage[id];
+        list<DataChunk> newList;
+        newList.push_back(DataChunk(cursor, rdata, rlimit_ids));
+        lst.merge(newList, [](const DataChunk& e1, const DataChunk& e2) { return e2.cursor <= e1.cursor; });
+    }
+
+    void clean_old_data_for_id(const ident_t& id, size_t max_num)
+    {
+        auto& lst = storage[id];
+        while (lst.size() > max_num) lst.pop_back();
+    }
+};
+
+// Data newer than the cursor in the order of sending.
+static string newer(const DataChunkChain& queue, cursor_t cursor)
+{
+    string result;
+    size_t first = Storage::DataToSend::first_newer(queue, cursor);
+    for (size_t i = queue.size(); i > first; i--) result += queue[i - 1].rdata->str() + ",";
+    return result;
+}
+
+static string newer(const list<DataChunk>& lst, cursor_t cursor)
+{
+    string result;
+    for (auto& item: lst) {
+        if (item.cursor <= cursor) break;
+        result += item.rdata->str() + ",";
+    }
+    return result;
+}
+
+static int test()
+{
+    std::mt19937 rnd(12345);
+    int failed = 0;
+    auto empty = make_local<RefLimitIdsSet>();
+    for (int round = 0; round < 2000; round++) {
+        Storage::DataToSend storage;
+        Reference reference;
+        ident_t id("id");
+        size_t max_num = rnd() % 8;
+        cursor_t cursor = 100;
+        for (int i = 0; i < 100; i++) {
+            // Mostly growing cursors, sometimes equal or older ones.
+            switch (rnd() % 4) {
+                case 0: case 1: cursor += rnd() % 3; break;
+                case 2: cursor -= std::min<cursor_t>(cursor, rnd() % 20); break;
+            }
+            auto rdata = make_local<RefString>(lexical_cast<string>(i));
+            storage.add_dataref_to_id(id, cursor, rdata, empty, max_num);
+            reference.add_dataref_to_id(id, cursor, rdata, empty);
+            // Sending.
+            if (rnd() % 3 == 0) {
+                storage.clean_old_data_for_id(id, max_num);
+                reference.clean_old_data_for_id(id, max_num);
+                cursor_t listen = cursor - std::min<cursor_t>(cursor, rnd() % 10);
+                string expected = newer(reference.storage[id], listen);
+                string actual = newer(storage.get_data_by_id(id), listen);
+                if (expected != actual && ++failed <= 10) {
+                    cout << "MISMATCH at round " << round << ", item " << i << "\n  expected: " << expected << "\n  actual:   " << actual << "\n";
+                }
+                // Sometimes MAX_DATA_FOR_ID is changed by reload (the
+                // reference cuts queues only before sending).
+                if (rnd() % 10 == 0) max_num = rnd() % 8;
+            }
+        }
+    }
+    cout << "data_to_send: " << failed << " mismatches\n";
+    return failed? 1 : 0;
+}
+
+static int bench()
+{
+    const size_t max_num = 30;
+    const int n = 3000000;
+    auto empty = make_local<RefLimitIdsSet>();
+    auto rdata = make_local<RefString>("data");
+    vector<ident_t> ids;
+    for (int i = 0; i < 1000; i++) ids.push_back(ident_t("id" + lexical_cast<string>(i)));
+    {
+        Reference reference;
+        auto t0 = std::chrono::steady_clock::now();
+        for (int i = 0; i < n; i++) {
+            reference.add_dataref_to_id(ids[i % ids.size()], i, rdata, empty);
+            reference.clean_old_data_for_id(ids[i % ids.size()], max_num);
+        }
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+        printf("%-8s %.1f ns per added item\n", "list", ns / n);
+    }
+    {
+        Storage::DataToSend storage;
+        auto t0 = std::chrono::steady_clock::now();
+        for (int i = 0; i < n; i++) {
+            storage.add_dataref_to_id(ids[i % ids.size()], i, rdata, empty, max_num);
+            storage.clean_old_data_for_id(ids[i % ids.size()], max_num);
+        }
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+        printf("%-8s %.1f ns per added item\n", "ring", ns / n);
+    }
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    return argc > 1 && string(argv[1]) == "--bench"? bench() : test();
+}
@@ -0,0 +1,372 @@
+//
+// Test of local_ptr handles and of data fan-out (Common::send_pendings()),
+// plus a benchmark of the fan-out cost per recipient.
+//
+// Usage (see run.sh):
+//   fanout           - run the test
+//   fanout --bench   - measure handle copies, fan-out per recipient and
+//                      deliveries per second (with and without the
+//                      encoding pool)
+//
+
+#define main dklab_realplexor_main
+#include "../../cpp/dklab_realplexor.cpp"
+#undef main
+
+#include <chrono>
+
+using namespace Realplexor;
+
+// Object which counts its instances.
+struct Counted: local_refcounted
+{
+    static int alive;
+    Counted() { alive++; }
+    ~Counted() { alive--; }
+};
+int Counted::alive = 0;
+
+// Registers fh as a listener of the IDs since the cursor.
+static void add_listener(const vector<ident_t>& ids, cursor_t cursor, const fh_t& fh)
+{
+    std::shared_ptr<DataPairChain> pairs(new DataPairChain());
+    for (auto& id: ids) {
+        pairs->push_back(DataPair(cursor, id));
+        connected_fhs.add_to_id(id, cursor, fh);
+    }
+    pairs_by_fhs.set_pairs_for_fh(fh, pairs);
+}
+
+static int test()
+{
+    int failed = 0;
+    auto check = [&](bool ok, const string& what) {
+        if (!ok && ++failed <= 10) cout << "FAILED: " << what << "\n";
+    };
+
+    // Handles.
+    {
+        local_ptr<Counted> a = make_local<Counted>();
+        local_ptr<const Counted> b = a;
+        local_ptr<Counted> c(a.get()); // recreated from a raw pointer
+        local_ptr<Counted> d = std::move(c);
+        check(!c && d.get() == a.get(), "move");
+        a.reset();
+        b = local_ptr<const Counted>();
+        check(Counted::alive == 1, "alive while referenced");
+        d = d;
+        check(Counted::alive == 1, "self-assignment");
+        local_ptr<Counted> e = make_local<Counted>();
+        d.swap(e);
+        d.reset();
+        check(Counted::alive == 1, "swap");
+    }
+    check(Counted::alive == 0, "all destroyed");
+
+    // Fan-out: each listener gets the data once, even if it is queued
+    // for multiple IDs, and is removed from Storages afterwards.
+    ident_t id1("fanout1"), id2("fanout2");
+    DataRef rdata = make_local<RefString>("\"payload\"");
+    DataRef older = make_local<RefString>("\"older\"");
+    LimitIdsRef limit_ids = make_local<RefLimitIdsSet>();
+    vector<int> readers;
+    for (int i = 0; i < 3; i++) {
+        int fds[2];
+        if (pipe(fds)) die("pipe() failed");
+        readers.push_back(fds[0]);
+        fh_t fh = std::make_shared<Event::FH>(std::make_shared<Socket>(fds[1], "pipe"));
+        add_listener({ id1, id2 }, 0, fh);
+    }
+    Common::push_data_to_id(id1, 5, older, limit_ids);
+    Common::push_data_to_id(id1, 10, rdata, limit_ids);
+    Common::push_data_to_id(id2, 20, rdata, limit_ids);
+    Common::send_pendings(vector<ident_t>{ id1, id2 });
+    for (int fd: readers) {
+        char buf[1024];
+        ssize_t n = read(fd, buf, sizeof(buf));
+        string out(buf, std::max<ssize_t>(n, 0));
+        check(out.find("\"payload\"") != string::npos && out.find("\"payload\"") == out.rfind("\"payload\""), "data sent once: " + out);
+        check(out.find("\"fanout1\": \"10\", \"fanout2\": \"20\"") != string::npos, "all IDs listed: " + out);
+        check(out.find("\"older\"") < out.find("\"payload\""), "ordered by cursor: " + out);
+        close(fd);
+    }
+    check(!connected_fhs.get_num_fhs_by_id(id1) && !connected_fhs.get_num_fhs_by_id(id2), "listeners removed");
+    check(!pairs_by_fhs.get_num_items(), "pairs removed");
+    data_to_send.clear_id(id1);
+    data_to_send.clear_id(id2);
+
+    // Limited data is sent only to listeners of one of the limiters.
+    ident_t room("fanout_room"), user1("fanout_user1"), user2("fanout_user2");
+    fh_t fhs[2];
+    for (int i = 0; i < 2; i++) {
+        int fds[2];
+        if (pipe(fds)) die("pipe() failed");
+        readers[i] = fds[0];
+        fhs[i] = std::make_shared<Event::FH>(std::make_shared<Socket>(fds[1], "pipe"));
+        add_listener({ room, i? user2 : user1 }, 0, fhs[i]);
+    }
+    LimitIdsRef private_ids = make_local<RefLimitIdsSet>();
+    private_ids->insert(user1);
+    private_ids->insert(ident_t("fanout_user3"));
+    Common::push_data_to_id(room, 30, rdata, private_ids);
+    Common::send_pendings(vector<ident_t>{ room });
+    check(pairs_by_fhs.get_pairs_by_fh(fhs[0]).empty(), "limited data sent");
+    check(pairs_by_fhs.get_pairs_by_fh(fhs[1]).size() == 2, "limited data not sent");
+    Common::push_data_to_id(room, 40, rdata, limit_ids);
+    Common::send_pendings(vector<ident_t>{ room });
+    check(pairs_by_fhs.get_pairs_by_fh(fhs[1]).empty(), "not limited data sent");
+    for (int i = 0; i < 2; i++) {
+        char buf[1024];
+        ssize_t n = read(readers[i], buf, sizeof(buf));
+        string out(buf, std::max<ssize_t>(n, 0));
+        check(out.find(i? "\"fanout_room\": \"40\"" : "\"fanout_room\": \"30\"") != string::npos, "response: " + out);
+        close(readers[i]);
+    }
+    data_to_send.clear_id(room);
+
+    // Huge fan-out is split into slices sent during next loop iterations;
+    // connections waiting in the queue receive all data published since.
+    CONFIG.fanout_slice = 2;
+    ident_t huge("fanout_huge");
+    readers.clear();
+    for (int i = 0; i < 5; i++) {
+        int fds[2];
+        if (pipe(fds)) die("pipe() failed");
+        readers.push_back(fds[0]);
+        add_listener({ huge }, 0, std::make_shared<Event::FH>(std::make_shared<Socket>(fds[1], "pipe")));
+    }
+    Common::push_data_to_id(huge, 50, older, limit_ids);
+    Common::send_pendings(vector<ident_t>{ huge });
+    check(Common::get_num_deferred() == 5, "all deferred");
+    ev_run(EV_DEFAULT, EVRUN_NOWAIT);
+    check(Common::get_num_deferred() == 3 && connected_fhs.get_num_fhs_by_id(huge) == 3, "first slice sent");
+    Common::push_data_to_id(huge, 60, rdata, limit_ids);
+    Common::send_pendings(vector<ident_t>{ huge });
+    check(Common::get_num_deferred() == 3, "not deferred twice");
+    ev_run(EV_DEFAULT, EVRUN_NOWAIT);
+    ev_run(EV_DEFAULT, EVRUN_NOWAIT);
+    check(Common::get_num_deferred() == 0 && connected_fhs.get_num_fhs_by_id(huge) == 0, "all slices sent");
+    int num_both = 0;
+    for (int fd: readers) {
+        char buf[1024];
+        ssize_t n = read(fd, buf, sizeof(buf));
+        string out(buf, std::max<ssize_t>(n, 0));
+        check(out.find("\"older\"") != string::npos, "sliced response: " + out);
+        if (out.find("\"payload\"") != string::npos) num_both++;
+        close(fd);
+    }
+    check(num_both == 3, "deferred connections receive all data");
+    data_to_send.clear_id(huge);
+
+    // Responses built by the encoding pool are the same as built inline.
+    CONFIG.fanout_slice = 0;
+    vector<ident_t> pooled = { ident_t("fanout_pool1"), ident_t("fanout_pool2") };
+    vector<string> outputs[2];
+    for (size_t threads: { 0, 2 }) {
+        CONFIG.encode_threads = threads;
+        readers.clear();
+        for (size_t i = 0; i < Common::POOL_MIN_FHS + 44; i++) {
+            int fds[2];
+            if (pipe(fds)) die("pipe() failed");
+            readers.push_back(fds[0]);
+            fh_t fh = std::make_shared<Event::FH>(std::make_shared<Socket>(fds[1], "pipe"));
+            add_listener(i % 3? pooled : vector<ident_t>{ pooled[i % 2] }, i % 4 * 10, fh);
+        }
+        for (cursor_t cursor = 5; cursor < 50; cursor += 10) {
+            Common::push_data_to_id(pooled[cursor % 2], cursor, cursor % 4 == 1? older : rdata, limit_ids);
+        }
+        Common::push_data_to_id(pooled[0], 50, rdata, limit_ids);
+        Common::push_data_to_id(pooled[1], 50, rdata, limit_ids);
+        Common::send_pendings(pooled);
+        check(connected_fhs.get_num_fhs_by_id(pooled[0]) == 0 && connected_fhs.get_num_fhs_by_id(pooled[1]) == 0, "pooled fan-out sent");
+        for (int fd: readers) {
+            char buf[4096];
+            ssize_t n = read(fd, buf, sizeof(buf));
+            outputs[threads? 1 : 0].push_back(string(buf, std::max<ssize_t>(n, 0)));
+            close(fd);
+        }
+        for (auto& id: pooled) data_to_send.clear_id(id);
+    }
+    check(outputs[0] == outputs[1], "pooled responses differ");
+    check(outputs[1][1].find("\"fanout_pool1\": \"50\", \"fanout_pool2\"") != string::npos, "pooled response: " + outputs[1][1]);
+    CONFIG.encode_threads = 0;
+
+    // Publishes of one loop iteration are sent at its end, at once.
+    ident_t coalesced("fanout_coalesced");
+    readers.clear();
+    for (int i = 0; i < 2; i++) {
+        int fds[2];
+        if (pipe(fds)) die("pipe() failed");
+        readers.push_back(fds[0]);
+        add_listener({ coalesced }, 0, std::make_shared<Event::FH>(std::make_shared<Socket>(fds[1], "pipe")));
+    }
+    Common::push_data_to_id(coalesced, 70, older, limit_ids);
+    Common::send_pendings_later(vector<ident_t>{ coalesced });
+    Common::push_data_to_id(coalesced, 80, rdata, limit_ids);
+    Common::send_pendings_later(vector<ident_t>{ coalesced });
+    check(connected_fhs.get_num_fhs_by_id(coalesced) == 2, "publish not delayed");
+    ev_run(EV_DEFAULT, EVRUN_NOWAIT);
+    check(connected_fhs.get_num_fhs_by_id(coalesced) == 0, "coalesced publishes sent");
+    for (int fd: readers) {
+        char buf[1024];
+        ssize_t n = read(fd, buf, sizeof(buf));
+        string out(buf, std::max<ssize_t>(n, 0));
+        check(out.find("\"older\"") != string::npos && out.find("\"payload\"") != string::npos, "coalesced response: " + out);
+        close(fd);
+    }
+    data_to_send.clear_id(coalesced);
+
+    cout << "fanout: " << failed << " failures\n";
+    return failed? 1 : 0;
+}
+
+// Copies a handle to each recipient (what a fan-out loop does).
+template<class Ptr>
+static double bench_copies(const Ptr& ptr, size_t recipients, int n)
+{
+    vector<Ptr> copies(recipients);
+    auto t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < n; i++) {
+        for (auto& copy: copies) copy = ptr;
+        for (auto& copy: copies) copy = Ptr();
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+    return ns / n / recipients;
+}
+
+// Sends one message to all fhs listening the ID at a time; returns the
+// cost per recipient.
+static double bench_send_pendings(const ident_t& id, const vector<fh_t>& fhs, int n)
+{
+    static cursor_t cursor = 0;
+    DataRef rdata = make_local<RefString>("\"" + string(100, 'x') + "\"");
+    LimitIdsRef limit_ids = make_local<RefLimitIdsSet>();
+    vector<ident_t> ids = { id };
+    double total = 0;
+    for (int i = 0; i < n; i++) {
+        for (auto& fh: fhs) add_listener(ids, cursor, fh);
+        auto t0 = std::chrono::steady_clock::now();
+        Common::push_data_to_id(id, ++cursor, rdata, limit_ids);
+        Common::send_pendings(ids);
+        total += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+    }
+    return total / n / fhs.size();
+}
+
+// Sends messages queued at IDs to subscribers which listen all of
+// them; returns deliveries (messages received by a subscriber) per second.
+static double bench_deliveries(const vector<ident_t>& ids, const vector<fh_t>& fhs, size_t messages, int n)
+{
+    vector<DataRef> rdatas;
+    for (size_t i = 0; i < messages; i++) {
+        rdatas.push_back(make_local<RefString>("\"" + string(100, 'a' + i % 26) + "\""));
+    }
+    LimitIdsRef limit_ids = make_local<RefLimitIdsSet>();
+    double total = 0;
+    for (int i = 0; i < n; i++) {
+        for (size_t j = 0; j < messages; j++) {
+            Common::push_data_to_id(ids[j % ids.size()], j + 1, rdatas[j], limit_ids);
+        }
+        for (auto& fh: fhs) add_listener(ids, 0, fh);
+        auto t0 = std::chrono::steady_clock::now();
+        Common::send_pendings(ids);
+        total += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        for (auto& id: ids) data_to_send.clear_id(id);
+    }
+    return messages * fhs.size() * n / total;
+}
+
+// Sends messages, each one visible to a few subscribers only, to all
+// subscribers of a room (each of them also listens its own ID); returns
+// the cost of a visibility check.
+static double bench_limited(const vector<fh_t>& fhs, size_t messages, int n)
+{
+    ident_t room("private_room");
+    vector<ident_t> users;
+    for (size_t i = 0; i < fhs.size(); i++) users.push_back(ident_t("private_user" + lexical_cast<string>(i)));
+    DataRef rdata = make_local<RefString>("\"" + string(100, 'x') + "\"");
+    double total = 0;
+    for (int i = 0; i < n; i++) {
+        for (size_t j = 0; j < messages; j++) {
+            LimitIdsRef limit_ids = make_local<RefLimitIdsSet>();
+            for (size_t k = 0; k < 3; k++) limit_ids->insert(users[(j * 7919 + k * 104729) % users.size()]);
+            Common::push_data_to_id(room, j + 1, rdata, limit_ids);
+        }
+        for (size_t j = 0; j < fhs.size(); j++) add_listener({ room, users[j] }, 0, fhs[j]);
+        auto t0 = std::chrono::steady_clock::now();
+        Common::send_pendings(vector<ident_t>{ room });
+        total += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+        data_to_send.clear_id(room);
+        for (auto& fh: fhs) {
+            for (auto& pair: pairs_by_fhs.get_pairs_by_fh(fh)) connected_fhs.del_from_id_by_fh(pair.id, fh);
+            pairs_by_fhs.remove_by_fh(fh);
+        }
+    }
+    return total / n / fhs.size() / messages;
+}
+
+static int bench()
+{
+    // Measure the whole fan-out within one call.
+    CONFIG.fanout_slice = 0;
+    const size_t recipients = 1000;
+    vector<fh_t> fhs;
+    for (size_t i = 0; i < recipients; i++) {
+        int fd = open("/dev/null", O_WRONLY);
+        if (fd < 0) die("cannot open /dev/null");
+        fhs.push_back(std::make_shared<Event::FH>(std::make_shared<Socket>(fd, "null")));
+    }
+    // libstdc++ makes shared_ptr counters atomic only after a thread is
+    // started (e.g. with IN_THREAD), so measure both modes.
+    for (string mode: { "1 thread", "2 threads" }) {
+        if (mode == "2 threads") std::thread([]() {}).join();
+        printf(
+            "%-10s %-14s %6.2f ns per copy\n", mode.c_str(), "shared_ptr",
+            bench_copies(std::make_shared<string>("data"), recipients, 20000)
+        );
+        printf(
+            "%-10s %-14s %6.2f ns per copy\n", mode.c_str(), "local_ptr",
+            bench_copies(make_local<RefString>("data"), recipients, 20000)
+        );
+        printf(
+            "%-10s %-14s %6.1f ns per recipient\n", mode.c_str(), "send_pendings",
+            bench_send_pendings(ident_t("fanout"), fhs, 2000)
+        );
+    }
+    // Many subscribers of a channel with a backlog of messages.
+    while (fhs.size() < 10000) {
+        int fd = open("/dev/null", O_WRONLY);
+        if (fd < 0) die("cannot open /dev/null");
+        fhs.push_back(std::make_shared<Event::FH>(std::make_shared<Socket>(fd, "null")));
+    }
+    for (size_t num_ids: { 1, 3 }) {
+        vector<ident_t> ids;
+        for (size_t i = 0; i < num_ids; i++) ids.push_back(ident_t("backlog" + lexical_cast<string>(i)));
+        // Responses are built by the main thread or by the pool.
+        for (size_t threads: { 0, 1, 3 }) {
+            CONFIG.encode_threads = threads;
+            printf(
+                "%zu subscribers x 30 messages at %zu ID(s), %zu encoding threads: %.2fM deliveries per second\n",
+                fhs.size(), num_ids, threads, bench_deliveries(ids, fhs, 30, 10) / 1e6
+            );
+        }
+        CONFIG.encode_threads = 0;
+    }
+    printf(
+        "%zu subscribers x 30 limited messages: %.2f ns per visibility check\n", fhs.size(),
+        bench_limited(fhs, 30, 10)
+    );
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    // Config is loaded relative to the daemon binary location.
+    string root = canonical(system_complete(argv[0])).parent_path().parent_path().parent_path().string();
+    string self = root + "/dklab_realplexor";
+    char* fake_argv[] = { (char*)self.c_str(), NULL };
+    init_argv(fake_argv);
+    CONFIG.load("", true);
+    CONFIG.verbosity = 0;
+    return argc > 1 && string(argv[1]) == "--bench"? bench() : test();
+}
@@ -0,0 +1,134 @@
+//
+// Randomized test of flat_map against std::map, plus a benchmark of
+// storage lookups at 1M keys.
+//
+// Usage (see run.sh):
+//   flat_map           - run the test
+//   flat_map --bench   - measure lookups per second
+//
+
+#define main dklab_realplexor_main
+#include "../../cpp/dklab_realplexor.cpp"
+#undef main
+
+#include <chrono>
+#include <random>
+
+using namespace Realplexor;
+
+// Bad hash: many keys share the home slot, so clusters wrap around
+// the array and erasure has to shift elements back.
+struct BadHash
+{
+    size_t operator()(int key) const { return key / 7; }
+};
+
+template<typename Hash>
+static int test_with(const char* name)
+{
+    std::mt19937 rnd(12345);
+    int failed = 0;
+    for (int round = 0; round < 200; round++) {
+        flat_map<int, int, Hash> m;
+        std::map<int, int> reference;
+        int range = 1 + rnd() % 300;
+        for (int i = 0; i < 3000; i++) {
+            int key = rnd() % range;
+            switch (rnd() % 4) {
+                case 0:
+                case 1:
+                    m[key] = reference[key] = i;
+                    break;
+                case 2:
+                    if (m.erase(key) != reference.erase(key)) failed++;
+                    break;
+                case 3: {
+                    auto it = m.find(key);
+                    if (it != m.end()) m.erase(it);
+                    reference.erase(key);
+                    break;
+                }
+            }
+            if (m.size() != reference.size()) failed++;
+        }
+        for (int key = 0; key < range; key++) {
+            auto it = m.find(key);
+            auto ref = reference.find(key);
+            if ((it == m.end()) != (ref == reference.end()) || (it != m.end() && it->second != ref->second)) failed++;
+        }
+        size_t n = 0;
+        for (auto& kv: m) n += reference.count(kv.first);
+        if (n != reference.size()) failed++;
+        // Copies are independent.
+        flat_map<int, int, Hash> copy = m;
+        copy[-1] = 1;
+        if (copy.size() != m.size() + 1 || m.count(-1)) failed++;
+    }
+    cout << name << ": " << failed << " mismatches\n";
+    return failed;
+}
+
+static int test()
+{
+    int failed = test_with<std::hash<int>>("std::hash") + test_with<BadHash>("bad hash");
+    // Elements are destroyed: interned strings are freed.
+    size_t interned = interned_string::count();
+    {
+        flat_map<ident_t, ident_t> m;
+        for (int i = 0; i < 1000; i++) m[ident_t("k" + lexical_cast<string>(i))] = ident_t("v" + lexical_cast<string>(i));
+        for (int i = 0; i < 500; i++) m.erase(ident_t("k" + lexical_cast<string>(i)));
+    }
+    if (interned_string::count() != interned) {
+        cout << "interned strings leaked\n";
+        failed++;
+    }
+    return failed? 1 : 0;
+}
+
+template<typename Map, typename Key>
+static void bench_map(const char* name, const vector<Key>& keys, const vector<Key>& lookups)
+{
+    Map m;
+    for (auto& key: keys) m[key];
+    auto t0 = std::chrono::steady_clock::now();
+    size_t found = 0;
+    for (auto& key: lookups) found += m.find(key) != m.end();
+    double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    printf("%-40s %6.1f M lookups/s (%zu found)\n", name, lookups.size() / s / 1e6, found);
+}
+
+static int bench()
+{
+    const size_t n = 1000000;
+    std::mt19937 rnd(54321);
+    vector<string> strs;
+    vector<ident_t> ids;
+    vector<void*> ptrs;
+    vector<std::unique_ptr<int>> objects;
+    for (size_t i = 0; i < n; i++) {
+        strs.push_back("testidentifier" + lexical_cast<string>(rnd()));
+        ids.push_back(ident_t(strs.back()));
+        objects.emplace_back(new int(i));
+        ptrs.push_back(objects.back().get());
+    }
+    vector<string> str_lookups;
+    vector<ident_t> id_lookups;
+    vector<void*> ptr_lookups;
+    for (size_t i = 0; i < n * 3; i++) {
+        size_t k = rnd() % n;
+        str_lookups.push_back(strs[k]);
+        id_lookups.push_back(ids[k]);
+        ptr_lookups.push_back(ptrs[k]);
+    }
+    bench_map<map<string, int>>("map<string> (IDs before interning)", strs, str_lookups);
+    bench_map<unordered_map<ident_t, int>>("unordered_map<ident_t>", ids, id_lookups);
+    bench_map<flat_map<ident_t, int>>("flat_map<ident_t>", ids, id_lookups);
+    bench_map<map<void*, int>>("map<void*> (FHs)", ptrs, ptr_lookups);
+    bench_map<flat_map<void*, int>>("flat_map<void*>", ptrs, ptr_lookups);
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    return argc > 1 && string(argv[1]) == "--bench"? bench() : test();
+}
@@ -0,0 +1,15 @@
+#!/bin/bash
+#
+# Builds and runs storage tests.
+# Pass --bench to run benchmarks instead.
+#
+
+cd `dirname $0`
+GCC="c++ -std=c++23"
+for test in flat_map data_to_send fanout arena; do
+    $GCC $test.cpp \
+        -O3 -Wfatal-errors -Wall -Werror \
+        -pthread -lcrypt -lboost_filesystem -lboost_system -lboost_regex -lev \
+        -o $test || exit $?
+    ./$test "$@" || exit $?
+done